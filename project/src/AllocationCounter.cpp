@@ -0,0 +1,107 @@
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+#ifndef NDEBUG
+namespace
+{
+std::atomic<size_t> g_AllocationCount{};
+} // namespace
+
+// Replacing the global operators counts the allocations of every thread, standard containers included
+void* operator new( std::size_t size )
+{
+	g_AllocationCount.fetch_add( 1, std::memory_order_relaxed );
+	if ( void* pMemory{ std::malloc( size ? size : 1 ) } )
+	{
+		return pMemory;
+	}
+	throw std::bad_alloc{};
+}
+
+void* operator new[]( std::size_t size )
+{
+	return ::operator new( size );
+}
+
+// Over-aligned types go through these instead, they need their own allocation functions to free what they got
+void* operator new( std::size_t size, std::align_val_t alignment )
+{
+	g_AllocationCount.fetch_add( 1, std::memory_order_relaxed );
+	const std::size_t alignmentBytes{ static_cast<std::size_t>( alignment ) };
+#ifdef _MSC_VER
+	void* pMemory{ _aligned_malloc( size ? size : 1, alignmentBytes ) };
+#else
+	// The size has to be a multiple of the alignment
+	const std::size_t alignedSize{ ( ( size ? size : 1 ) + alignmentBytes - 1 ) & ~( alignmentBytes - 1 ) };
+	void* pMemory{ std::aligned_alloc( alignmentBytes, alignedSize ) };
+#endif
+	if ( pMemory )
+	{
+		return pMemory;
+	}
+	throw std::bad_alloc{};
+}
+
+void* operator new[]( std::size_t size, std::align_val_t alignment )
+{
+	return ::operator new( size, alignment );
+}
+
+void operator delete( void* pMemory ) noexcept
+{
+	std::free( pMemory );
+}
+
+void operator delete[]( void* pMemory ) noexcept
+{
+	std::free( pMemory );
+}
+
+void operator delete( void* pMemory, std::size_t ) noexcept
+{
+	std::free( pMemory );
+}
+
+void operator delete[]( void* pMemory, std::size_t ) noexcept
+{
+	std::free( pMemory );
+}
+
+void operator delete( void* pMemory, std::align_val_t ) noexcept
+{
+#ifdef _MSC_VER
+	_aligned_free( pMemory );
+#else
+	std::free( pMemory );
+#endif
+}
+
+void operator delete[]( void* pMemory, std::align_val_t alignment ) noexcept
+{
+	::operator delete( pMemory, alignment );
+}
+
+void operator delete( void* pMemory, std::size_t, std::align_val_t alignment ) noexcept
+{
+	::operator delete( pMemory, alignment );
+}
+
+void operator delete[]( void* pMemory, std::size_t, std::align_val_t alignment ) noexcept
+{
+	::operator delete( pMemory, alignment );
+}
+#endif
+
+size_t dae::GetAllocationCount() noexcept
+{
+#ifndef NDEBUG
+	return g_AllocationCount.load( std::memory_order_relaxed );
+#else
+	return 0;
+#endif
+}
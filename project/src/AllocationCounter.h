@@ -0,0 +1,14 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstddef>
+
+// Debug builds count every allocation through operator new, so code that should not allocate can check that it does not
+
+namespace dae
+{
+// Amount of allocations since the program started, always zero in release builds
+size_t GetAllocationCount() noexcept;
+} // namespace dae
+
+#endif
@@ -1,3 +1,4 @@
+#include <cstring>
 #include "Camera.h"
 #include "SDL_keyboard.h"
 
@@ -38,6 +39,24 @@ float Camera::GetFar() const
 	return m_Far;
 }
 
+uint32_t Camera::GetVersion() const
+{
+	return m_Version;
+}
+
+FrustumPlanes Camera::GetFrustumPlanes( float aspectRatio ) const
+{
+	// The side planes go through the origin, tilted by how far the view reaches sideways at a depth of one
+	const float halfWidth{ aspectRatio * m_Fov };
+	const float halfHeight{ m_Fov };
+	return { Plane{ Vector3::UnitZ, -m_Near },
+			 Plane{ -Vector3::UnitZ, m_Far },
+			 Plane{ Vector3{ 1.f, 0.f, halfWidth }.Normalized(), 0.f },
+			 Plane{ Vector3{ -1.f, 0.f, halfWidth }.Normalized(), 0.f },
+			 Plane{ Vector3{ 0.f, -1.f, halfHeight }.Normalized(), 0.f },
+			 Plane{ Vector3{ 0.f, 1.f, halfHeight }.Normalized(), 0.f } };
+}
+
 // Setters
 void Camera::SetPos( const Vector3& newPos )
 {
@@ -49,6 +68,7 @@ void Camera::SetFovAngleDegrees( float newFovAngle )
 {
 	m_FovAngle = newFovAngle / 180.f * PI;
 	m_Fov = tanf( m_FovAngle * 0.5f );
+	++m_Version;
 }
 
 // Methods
@@ -98,7 +118,13 @@ void Camera::Update( Timer* pTimer )
 
 	// Mouse Input
 	int mouseX{}, mouseY{};
-	const uint32_t mouseState = SDL_GetRelativeMouseState( &mouseX, &mouseY );
+	uint32_t mouseState = SDL_GetRelativeMouseState( &mouseX, &mouseY );
+
+	// Holding a button without moving the mouse leaves the camera where it is
+	if ( mouseX == 0 && mouseY == 0 )
+	{
+		mouseState = 0;
+	}
 
 	if ( mouseState == SDL_BUTTON_RMASK )
 	{
@@ -121,7 +147,13 @@ void Camera::Update( Timer* pTimer )
 	// Update ONB if needed
 	if ( m_UpdateONB )
 	{
-		m_CameraToWorld = CalculateCameraToWorld();
+		// Only a basis that actually changed makes what was rendered with the old one stale
+		const Matrix cameraToWorld{ CalculateCameraToWorld() };
+		if ( std::memcmp( &cameraToWorld, &m_CameraToWorld, sizeof( Matrix ) ) != 0 )
+		{
+			m_CameraToWorld = cameraToWorld;
+			++m_Version;
+		}
 		m_UpdateONB = false;
 	}
 }
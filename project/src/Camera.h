@@ -1,12 +1,28 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <array>
 #include <SDL_mouse.h>
 #include "Maths.h"
 #include "Timer.h"
 
 namespace dae
 {
+// Points on the side the normal faces have a positive distance
+struct Plane
+{
+	Vector3 normal{};
+	float distance{};
+
+	float GetSignedDistance( const Vector3& point ) const
+	{
+		return Vector3::Dot( normal, point ) + distance;
+	}
+};
+
+// Facing inwards, in the order near, far, left, right, top, bottom
+using FrustumPlanes = std::array<Plane, 6>;
+
 class Camera final
 {
 public:
@@ -19,6 +35,10 @@ public:
 	float GetFov() const;
 	float GetNear() const;
 	float GetFar() const;
+	// Changes whenever anything the projection depends on does
+	uint32_t GetVersion() const;
+	// In view space, so they stay the same while the camera moves
+	FrustumPlanes GetFrustumPlanes( float aspectRatio ) const;
 
 	// Setters
 	void SetPos( const Vector3& newPos );
@@ -46,6 +66,7 @@ private:
 
 	Matrix m_CameraToWorld{};
 	bool m_UpdateONB{ true };
+	uint32_t m_Version{};
 
 	// Methods
 	Matrix CalculateCameraToWorld();
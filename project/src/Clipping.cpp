@@ -0,0 +1,435 @@
+#include "Clipping.h"
+#include <algorithm>
+#include <utility>
+#include "GBuffer.h"
+#include "Rasterization.h"
+
+#if defined( SIMD_AVX2 )
+#	include <immintrin.h>
+#elif defined( SIMD_SSE )
+#	include <emmintrin.h>
+#endif
+
+namespace dae
+{
+namespace
+{
+struct ClipVertex
+{
+	Vector4 clipPosition{};
+	VertexOut vertexOut{};
+	bool isProjected{ true };
+};
+
+using ClipPolygon = std::array<ClipVertex, MAX_CLIPPED_VERTICES>;
+
+VertexOut Lerp( const VertexOut& from, const VertexOut& to, float factor ) noexcept
+{
+	VertexOut vertex{};
+	vertex.color = ColorRGB::Lerp( from.color, to.color, factor );
+	vertex.uv = from.uv + ( to.uv - from.uv ) * factor;
+	vertex.normal = from.normal + ( to.normal - from.normal ) * factor;
+	vertex.tangent = from.tangent + ( to.tangent - from.tangent ) * factor;
+	vertex.viewPosition = from.viewPosition + ( to.viewPosition - from.viewPosition ) * factor;
+	return vertex;
+}
+
+// Signed distance to a clip plane, positive on the inside
+float GetPlaneDistance( const Vector4& clipPosition, uint32_t plane, const Projection& projection ) noexcept
+{
+	switch ( plane )
+	{
+	case OUTSIDE_NEAR:
+		return clipPosition.z;
+	case OUTSIDE_FAR:
+		return clipPosition.w - clipPosition.z;
+	case OUTSIDE_LEFT:
+		return projection.guardBandX * clipPosition.w + clipPosition.x;
+	case OUTSIDE_RIGHT:
+		return projection.guardBandX * clipPosition.w - clipPosition.x;
+	case OUTSIDE_TOP:
+		return projection.guardBandY * clipPosition.w - clipPosition.y;
+	case OUTSIDE_BOTTOM:
+		return projection.guardBandY * clipPosition.w + clipPosition.y;
+	default:
+		return 0.f;
+	}
+}
+
+// A batch of projected vertices, one array per value
+struct VertexBatch
+{
+	alignas( 32 ) std::array<float, VERTEX_BATCH_SIZE> viewX{};
+	alignas( 32 ) std::array<float, VERTEX_BATCH_SIZE> viewY{};
+	alignas( 32 ) std::array<float, VERTEX_BATCH_SIZE> viewZ{};
+	alignas( 32 ) std::array<float, VERTEX_BATCH_SIZE> screenX{};
+	alignas( 32 ) std::array<float, VERTEX_BATCH_SIZE> screenY{};
+	alignas( 32 ) std::array<float, VERTEX_BATCH_SIZE> depth{};
+};
+
+// Every vertex goes through the same code no matter where it sits in its batch
+// Duplicated vertices thus land on exactly the same spot, which keeps shared edges watertight
+void TransformBatch( const float* pX,
+					 const float* pY,
+					 const float* pZ,
+					 const Matrix& modelToView,
+					 const Projection& projection,
+					 VertexBatch& batch ) noexcept
+{
+#if defined( SIMD_AVX2 )
+	const __m256 x{ _mm256_loadu_ps( pX ) };
+	const __m256 y{ _mm256_loadu_ps( pY ) };
+	const __m256 z{ _mm256_loadu_ps( pZ ) };
+
+	const auto transformAxis{ [&]( int axis ) {
+		__m256 result{ _mm256_set1_ps( modelToView[3][axis] ) };
+		result = _mm256_fmadd_ps( z, _mm256_set1_ps( modelToView[2][axis] ), result );
+		result = _mm256_fmadd_ps( y, _mm256_set1_ps( modelToView[1][axis] ), result );
+		return _mm256_fmadd_ps( x, _mm256_set1_ps( modelToView[0][axis] ), result );
+	} };
+	const __m256 viewX{ transformAxis( 0 ) };
+	const __m256 viewY{ transformAxis( 1 ) };
+	const __m256 viewZ{ transformAxis( 2 ) };
+
+	// Clip space keeps the view depth in w, so the divide is by viewZ
+	const __m256 one{ _mm256_set1_ps( 1.f ) };
+	const __m256 ndcX{ _mm256_div_ps( _mm256_mul_ps( viewX, _mm256_set1_ps( projection.scaleX ) ), viewZ ) };
+	const __m256 ndcY{ _mm256_div_ps( _mm256_mul_ps( viewY, _mm256_set1_ps( projection.scaleY ) ), viewZ ) };
+	const __m256 clipZ{
+		_mm256_fmadd_ps( viewZ, _mm256_set1_ps( projection.depthScale ), _mm256_set1_ps( projection.depthOffset ) ) };
+
+	_mm256_store_ps( batch.viewX.data(), viewX );
+	_mm256_store_ps( batch.viewY.data(), viewY );
+	_mm256_store_ps( batch.viewZ.data(), viewZ );
+	_mm256_store_ps( batch.screenX.data(),
+					 _mm256_mul_ps( _mm256_add_ps( one, ndcX ), _mm256_set1_ps( projection.halfWidth ) ) );
+	_mm256_store_ps( batch.screenY.data(),
+					 _mm256_mul_ps( _mm256_sub_ps( one, ndcY ), _mm256_set1_ps( projection.halfHeight ) ) );
+	_mm256_store_ps( batch.depth.data(), _mm256_div_ps( clipZ, viewZ ) );
+#elif defined( SIMD_SSE )
+	// Two halves of four
+	for ( size_t half{}; half < VERTEX_BATCH_SIZE; half += 4 )
+	{
+		const __m128 x{ _mm_loadu_ps( pX + half ) };
+		const __m128 y{ _mm_loadu_ps( pY + half ) };
+		const __m128 z{ _mm_loadu_ps( pZ + half ) };
+
+		const auto transformAxis{ [&]( int axis ) {
+			__m128 result{ _mm_mul_ps( x, _mm_set1_ps( modelToView[0][axis] ) ) };
+			result = _mm_add_ps( result, _mm_mul_ps( y, _mm_set1_ps( modelToView[1][axis] ) ) );
+			result = _mm_add_ps( result, _mm_mul_ps( z, _mm_set1_ps( modelToView[2][axis] ) ) );
+			return _mm_add_ps( result, _mm_set1_ps( modelToView[3][axis] ) );
+		} };
+		const __m128 viewX{ transformAxis( 0 ) };
+		const __m128 viewY{ transformAxis( 1 ) };
+		const __m128 viewZ{ transformAxis( 2 ) };
+
+		const __m128 one{ _mm_set1_ps( 1.f ) };
+		const __m128 ndcX{ _mm_div_ps( _mm_mul_ps( viewX, _mm_set1_ps( projection.scaleX ) ), viewZ ) };
+		const __m128 ndcY{ _mm_div_ps( _mm_mul_ps( viewY, _mm_set1_ps( projection.scaleY ) ), viewZ ) };
+		const __m128 clipZ{
+			_mm_add_ps( _mm_mul_ps( viewZ, _mm_set1_ps( projection.depthScale ) ), _mm_set1_ps( projection.depthOffset ) ) };
+
+		_mm_store_ps( batch.viewX.data() + half, viewX );
+		_mm_store_ps( batch.viewY.data() + half, viewY );
+		_mm_store_ps( batch.viewZ.data() + half, viewZ );
+		_mm_store_ps( batch.screenX.data() + half, _mm_mul_ps( _mm_add_ps( one, ndcX ), _mm_set1_ps( projection.halfWidth ) ) );
+		_mm_store_ps( batch.screenY.data() + half, _mm_mul_ps( _mm_sub_ps( one, ndcY ), _mm_set1_ps( projection.halfHeight ) ) );
+		_mm_store_ps( batch.depth.data() + half, _mm_div_ps( clipZ, viewZ ) );
+	}
+#else
+	for ( size_t lane{}; lane < VERTEX_BATCH_SIZE; ++lane )
+	{
+		const Vector3 viewPosition{ modelToView.TransformPoint( pX[lane], pY[lane], pZ[lane] ) };
+		const Vector4 screenPosition{ projection.ToScreenSpace( projection.ToClipSpace( viewPosition ) ) };
+		batch.viewX[lane] = viewPosition.x;
+		batch.viewY[lane] = viewPosition.y;
+		batch.viewZ[lane] = viewPosition.z;
+		batch.screenX[lane] = screenPosition.x;
+		batch.screenY[lane] = screenPosition.y;
+		batch.depth[lane] = screenPosition.z;
+	}
+#endif
+}
+
+// Quantized positions become floats as they are, the dequantization is part of the transform
+void WidenBatch( const uint16_t* pQuantized, float* pWidened ) noexcept
+{
+#if defined( SIMD_AVX2 )
+	const __m128i quantized{ _mm_loadu_si128( reinterpret_cast<const __m128i*>( pQuantized ) ) };
+	_mm256_store_ps( pWidened, _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32( quantized ) ) );
+#elif defined( SIMD_SSE )
+	const __m128i quantized{ _mm_loadu_si128( reinterpret_cast<const __m128i*>( pQuantized ) ) };
+	const __m128i zero{ _mm_setzero_si128() };
+	_mm_store_ps( pWidened, _mm_cvtepi32_ps( _mm_unpacklo_epi16( quantized, zero ) ) );
+	_mm_store_ps( pWidened + 4, _mm_cvtepi32_ps( _mm_unpackhi_epi16( quantized, zero ) ) );
+#else
+	for ( size_t lane{}; lane < VERTEX_BATCH_SIZE; ++lane )
+	{
+		pWidened[lane] = static_cast<float>( pQuantized[lane] );
+	}
+#endif
+}
+
+int ClipPolygonToPlane( const ClipPolygon& polygon,
+						int vertexCount,
+						uint32_t plane,
+						const Projection& projection,
+						ClipPolygon& polygonOut ) noexcept
+{
+	int vertexCountOut{};
+	for ( int index{}; index < vertexCount; ++index )
+	{
+		const ClipVertex& current{ polygon[index] };
+		const ClipVertex& next{ polygon[( index + 1 ) % vertexCount] };
+		const float currentDistance{ GetPlaneDistance( current.clipPosition, plane, projection ) };
+		const float nextDistance{ GetPlaneDistance( next.clipPosition, plane, projection ) };
+
+		if ( currentDistance >= 0.f )
+		{
+			polygonOut[vertexCountOut++] = current;
+		}
+
+		// Edge crosses the plane, the new vertex gets projected after all planes are done
+		if ( ( currentDistance >= 0.f ) != ( nextDistance >= 0.f ) )
+		{
+			const float factor{ currentDistance / ( currentDistance - nextDistance ) };
+			ClipVertex& intersection{ polygonOut[vertexCountOut++] };
+			intersection.clipPosition = current.clipPosition + ( next.clipPosition - current.clipPosition ) * factor;
+			intersection.vertexOut = Lerp( current.vertexOut, next.vertexOut, factor );
+			intersection.isProjected = false;
+		}
+	}
+	return vertexCountOut;
+}
+} // namespace
+
+Projection::Projection( const Camera& camera, int width, int height )
+{
+	const float aspectRatio{ static_cast<float>( width ) / height };
+	scaleX = 1.f / ( aspectRatio * camera.GetFov() );
+	scaleY = 1.f / camera.GetFov();
+	depthScale = camera.GetFar() / ( camera.GetFar() - camera.GetNear() ); // Depends on coordinate system
+	depthOffset = -( camera.GetFar() * camera.GetNear() ) / ( camera.GetFar() - camera.GetNear() );
+	halfWidth = 0.5f * width;
+	halfHeight = 0.5f * height;
+
+	guardBandX = 1.f + GUARD_BAND / halfWidth;
+	guardBandY = 1.f + GUARD_BAND / halfHeight;
+}
+
+Vector4 Projection::ToClipSpace( const Vector3& viewPosition ) const noexcept
+{
+	return { viewPosition.x * scaleX,
+			 viewPosition.y * scaleY,
+			 viewPosition.z * depthScale + depthOffset,
+			 viewPosition.z };
+}
+
+Vector4 Projection::ToScreenSpace( const Vector4& clipPosition ) const noexcept
+{
+	return { ( 1.f + clipPosition.x / clipPosition.w ) * halfWidth,
+			 ( 1.f - clipPosition.y / clipPosition.w ) * halfHeight,
+			 clipPosition.z / clipPosition.w,
+			 clipPosition.w };
+}
+
+uint32_t Projection::GetOutcode( const Vector4& clipPosition ) const noexcept
+{
+	const float x{ clipPosition.x };
+	const float y{ clipPosition.y };
+	const float w{ clipPosition.w };
+
+	uint32_t outcode{};
+	outcode |= clipPosition.z < 0.f ? OUTSIDE_NEAR : 0;
+	outcode |= clipPosition.z > w ? OUTSIDE_FAR : 0;
+	outcode |= x < -w ? OUTSIDE_LEFT : 0;
+	outcode |= x > w ? OUTSIDE_RIGHT : 0;
+	outcode |= y > w ? OUTSIDE_TOP : 0;
+	outcode |= y < -w ? OUTSIDE_BOTTOM : 0;
+	outcode |= ( x < -guardBandX * w || x > guardBandX * w || y < -guardBandY * w || y > guardBandY * w )
+				   ? OUTSIDE_GUARD_BAND
+				   : 0;
+	return outcode;
+}
+
+Vector3 Projection::ToViewSpace( float screenX, float screenY, float depth ) const noexcept
+{
+	const float viewDepth{ ToViewDepth( depth ) };
+	return { ( screenX / halfWidth - 1.f ) * viewDepth / scaleX,
+			 ( 1.f - screenY / halfHeight ) * viewDepth / scaleY,
+			 viewDepth };
+}
+
+float Projection::ToViewDepth( float depth ) const noexcept
+{
+	return depthOffset / ( depth - depthScale );
+}
+
+void ProjectVertexBatch( const Mesh& mesh,
+						 size_t firstVertex,
+						 const Matrix& modelToView,
+						 const Matrix& positionToView,
+						 const Projection& projection,
+						 std::vector<VertexOut>& verticesOut ) noexcept
+{
+	VertexBatch batch{};
+	if ( mesh.isCompressed )
+	{
+		alignas( 32 ) std::array<float, VERTEX_BATCH_SIZE> positionsX{};
+		alignas( 32 ) std::array<float, VERTEX_BATCH_SIZE> positionsY{};
+		alignas( 32 ) std::array<float, VERTEX_BATCH_SIZE> positionsZ{};
+		WidenBatch( mesh.compressed.positionsX.data() + firstVertex, positionsX.data() );
+		WidenBatch( mesh.compressed.positionsY.data() + firstVertex, positionsY.data() );
+		WidenBatch( mesh.compressed.positionsZ.data() + firstVertex, positionsZ.data() );
+		TransformBatch( positionsX.data(), positionsY.data(), positionsZ.data(), positionToView, projection, batch );
+	}
+	else
+	{
+		TransformBatch( mesh.positionsX.data() + firstVertex,
+						mesh.positionsY.data() + firstVertex,
+						mesh.positionsZ.data() + firstVertex,
+						positionToView,
+						projection,
+						batch );
+	}
+
+	// Vertices behind the camera end up with a meaningless screen position, the clipper replaces those
+	const size_t vertexCount{ std::min( VERTEX_BATCH_SIZE, mesh.GetVertexCount() - firstVertex ) };
+	for ( size_t lane{}; lane < vertexCount; ++lane )
+	{
+		VertexOut& vertexOut{ verticesOut[firstVertex + lane] };
+		vertexOut.viewPosition = { batch.viewX[lane], batch.viewY[lane], batch.viewZ[lane] };
+		vertexOut.position = { batch.screenX[lane], batch.screenY[lane], batch.depth[lane], batch.viewZ[lane] };
+	}
+
+	if ( mesh.isCompressed )
+	{
+		const CompressedVertices& compressed{ mesh.compressed };
+		for ( size_t lane{}; lane < vertexCount; ++lane )
+		{
+			VertexOut& vertexOut{ verticesOut[firstVertex + lane] };
+			vertexOut.uv = packing::UnpackHalf2x16( compressed.uvs[firstVertex + lane] );
+			vertexOut.normal = modelToView.TransformVector( packing::UnpackUnitVector( compressed.normals[firstVertex + lane] ) );
+			vertexOut.tangent =
+				modelToView.TransformVector( packing::UnpackUnitVector( compressed.tangents[firstVertex + lane] ) );
+		}
+		return;
+	}
+
+	for ( size_t lane{}; lane < vertexCount; ++lane )
+	{
+		VertexOut& vertexOut{ verticesOut[firstVertex + lane] };
+		const Vertex& vertex{ mesh.vertices[firstVertex + lane] };
+		vertexOut.uv = vertex.uv;
+		vertexOut.normal = modelToView.TransformVector( vertex.normal );
+		vertexOut.tangent = modelToView.TransformVector( vertex.tangent );
+	}
+}
+
+float GetLargestScale( const Matrix& matrix ) noexcept
+{
+	return std::max( { matrix.TransformVector( Vector3::UnitX ).Magnitude(),
+					   matrix.TransformVector( Vector3::UnitY ).Magnitude(),
+					   matrix.TransformVector( Vector3::UnitZ ).Magnitude() } );
+}
+
+Containment ClassifyBounds( const Bounds& bounds, const Matrix& modelToView, const FrustumPlanes& planes ) noexcept
+{
+	const Vector3 sphereCenter{ modelToView.TransformPoint( bounds.sphereCenter ) };
+	const float sphereRadius{ bounds.sphereRadius * GetLargestScale( modelToView ) };
+
+	bool isSphereInside{ true };
+	for ( const Plane& plane : planes )
+	{
+		const float distance{ plane.GetSignedDistance( sphereCenter ) };
+		if ( distance < -sphereRadius )
+		{
+			return Containment::outside;
+		}
+		isSphereInside &= distance >= sphereRadius;
+	}
+	if ( isSphereInside )
+	{
+		return Containment::inside;
+	}
+
+	// The box is the tighter fit, which matters most for long and thin meshes
+	std::array<Vector3, 8> corners{};
+	for ( size_t corner{}; corner < corners.size(); ++corner )
+	{
+		corners[corner] = modelToView.TransformPoint( corner & 1 ? bounds.boxMax.x : bounds.boxMin.x,
+													  corner & 2 ? bounds.boxMax.y : bounds.boxMin.y,
+													  corner & 4 ? bounds.boxMax.z : bounds.boxMin.z );
+	}
+
+	Containment containment{ Containment::inside };
+	for ( const Plane& plane : planes )
+	{
+		const auto insideCount{ std::count_if( corners.begin(), corners.end(), [&]( const Vector3& corner ) {
+			return plane.GetSignedDistance( corner ) >= 0.f;
+		} ) };
+		if ( insideCount == 0 )
+		{
+			return Containment::outside;
+		}
+		if ( insideCount < static_cast<std::ptrdiff_t>( corners.size() ) )
+		{
+			containment = Containment::intersecting;
+		}
+	}
+	return containment;
+}
+
+int ClipTriangle( const TriangleOut& triangle,
+				  const Projection& projection,
+				  uint32_t planes,
+				  std::array<TriangleOut, MAX_CLIPPED_TRIANGLES>& trianglesOut ) noexcept
+{
+	ClipPolygon polygon{};
+	ClipPolygon polygonOut{};
+	polygon[0] = { projection.ToClipSpace( triangle.v0.viewPosition ), triangle.v0 };
+	polygon[1] = { projection.ToClipSpace( triangle.v1.viewPosition ), triangle.v1 };
+	polygon[2] = { projection.ToClipSpace( triangle.v2.viewPosition ), triangle.v2 };
+	int vertexCount{ 3 };
+
+	// Outside the guard band means clipping against all four of its sides
+	if ( planes & OUTSIDE_GUARD_BAND )
+	{
+		planes |= OUTSIDE_LEFT | OUTSIDE_RIGHT | OUTSIDE_TOP | OUTSIDE_BOTTOM;
+	}
+
+	for ( const uint32_t plane :
+		  { OUTSIDE_NEAR, OUTSIDE_FAR, OUTSIDE_LEFT, OUTSIDE_RIGHT, OUTSIDE_TOP, OUTSIDE_BOTTOM } )
+	{
+		if ( !( planes & plane ) )
+		{
+			continue;
+		}
+		vertexCount = ClipPolygonToPlane( polygon, vertexCount, plane, projection, polygonOut );
+		std::swap( polygon, polygonOut );
+		if ( vertexCount < 3 )
+		{
+			return 0;
+		}
+	}
+
+	// Only the new vertices still need their projection
+	for ( int index{}; index < vertexCount; ++index )
+	{
+		if ( !polygon[index].isProjected )
+		{
+			polygon[index].vertexOut.position = projection.ToScreenSpace( polygon[index].clipPosition );
+		}
+	}
+
+	const int triangleCount{ vertexCount - 2 };
+	for ( int index{}; index < triangleCount; ++index )
+	{
+		trianglesOut[index] = TriangleOut{ polygon[0].vertexOut, polygon[index + 1].vertexOut, polygon[index + 2].vertexOut };
+		trianglesOut[index].pTexture = triangle.pTexture;
+		trianglesOut[index].pNormalMap = triangle.pNormalMap;
+	}
+	return triangleCount;
+}
+} // namespace dae
@@ -0,0 +1,94 @@
+#ifndef CLIPPING_H
+#define CLIPPING_H
+
+#include <array>
+#include <cstdint>
+#include "Camera.h"
+#include "DataTypes.h"
+
+// Everything related to getting triangles from view space onto the screen
+
+namespace dae
+{
+// Screen positions stay within this many pixels of the screen, which keeps them exact after snapping to the subpixel grid
+// Only triangles that reach beyond it get clipped in x and y, the others are scissored while rasterizing
+constexpr float GUARD_BAND{ 8192.f };
+
+// Outcode bits, a set bit means the vertex lies outside of that plane
+constexpr uint32_t OUTSIDE_NEAR{ 1 << 0 };
+constexpr uint32_t OUTSIDE_FAR{ 1 << 1 };
+constexpr uint32_t OUTSIDE_LEFT{ 1 << 2 };
+constexpr uint32_t OUTSIDE_RIGHT{ 1 << 3 };
+constexpr uint32_t OUTSIDE_TOP{ 1 << 4 };
+constexpr uint32_t OUTSIDE_BOTTOM{ 1 << 5 };
+constexpr uint32_t OUTSIDE_GUARD_BAND{ 1 << 6 };
+
+// Planes that cannot be left to the scissor
+constexpr uint32_t CLIP_PLANES{ OUTSIDE_NEAR | OUTSIDE_FAR | OUTSIDE_GUARD_BAND };
+
+// Every plane a polygon gets clipped against can add one vertex, a fan over those needs two less triangles
+constexpr int MAX_CLIPPED_VERTICES{ 9 };
+constexpr int MAX_CLIPPED_TRIANGLES{ MAX_CLIPPED_VERTICES - 2 };
+
+// Maps view space to clip space and clip space to the screen
+struct Projection
+{
+	Projection() = default;
+	Projection( const Camera& camera, int width, int height );
+
+	float scaleX{};
+	float scaleY{};
+	float depthScale{};
+	float depthOffset{};
+	float halfWidth{};
+	float halfHeight{};
+
+	// Guard band edges in normalized device coordinates
+	float guardBandX{};
+	float guardBandY{};
+
+	Vector4 ToClipSpace( const Vector3& viewPosition ) const noexcept;
+	// Perspective divide and viewport transform, keeps the view depth in w
+	Vector4 ToScreenSpace( const Vector4& clipPosition ) const noexcept;
+	uint32_t GetOutcode( const Vector4& clipPosition ) const noexcept;
+	// From a screen position and the depth after the perspective divide back to view space
+	Vector3 ToViewSpace( float screenX, float screenY, float depth ) const noexcept;
+	// Only the view depth of a depth after the perspective divide
+	float ToViewDepth( float depth ) const noexcept;
+};
+
+// Takes the vertices [firstVertex, firstVertex + VERTEX_BATCH_SIZE) of the mesh from model space onto the screen
+// Writes their view space position, normal and tangent, screen position and uv
+// The padding past the last vertex gets computed but not written
+// Positions go through positionToView, which for a compressed mesh starts with its dequantization
+void ProjectVertexBatch( const Mesh& mesh,
+						 size_t firstVertex,
+						 const Matrix& modelToView,
+						 const Matrix& positionToView,
+						 const Projection& projection,
+						 std::vector<VertexOut>& verticesOut ) noexcept;
+
+// Where a mesh lies relative to the view frustum
+enum class Containment
+{
+	outside,	  // Nothing of it can end up on the screen
+	intersecting, // Some of its triangles may need clipping
+	inside,		  // None of its triangles need clipping
+};
+
+// How much the matrix stretches along its longest axis, which bounding spheres have to grow by
+float GetLargestScale( const Matrix& matrix ) noexcept;
+
+// Tests the bounding sphere first and only falls back to the corners of the box when the sphere crosses a plane
+Containment ClassifyBounds( const Bounds& bounds, const Matrix& modelToView, const FrustumPlanes& planes ) noexcept;
+
+// Sutherland-Hodgman clipping against the near and far plane and the guard band
+// The polygon that remains gets written out as a fan, vertices that were inside keep their projected position untouched
+// Returns the amount of triangles written
+int ClipTriangle( const TriangleOut& triangle,
+				  const Projection& projection,
+				  uint32_t planes,
+				  std::array<TriangleOut, MAX_CLIPPED_TRIANGLES>& trianglesOut ) noexcept;
+} // namespace dae
+
+#endif
@@ -2,7 +2,10 @@
 #define DATATYPES_H
 
 #include <vector>
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstdint>
 #include "Vector2.h"
 #include "Matrix.h"
 #include "Texture.h"
@@ -35,6 +38,7 @@ struct VertexOut
 	Vector2 uv{};
 	Vector3 normal{};
 	Vector3 tangent{};
+	Vector3 viewPosition{};
 	// Vector3 viewDirection{};
 };
 
@@ -46,24 +50,21 @@ struct Rectangle
 	float bottom{};
 };
 
-struct TriangleWorld
+// Screen region of which the pixels are owned by a single rasterizer job
+struct Tile
 {
-	TriangleWorld() = default;
-	TriangleWorld( const Vertex& v0, const Vertex& v1, const Vertex& v2 )
-		: v0{ v0 }
-		, v1{ v1 }
-		, v2{ v2 }
-		, normal{
-			Vector3::Cross( Vector3( v0.position, v2.position ), Vector3( v0.position, v1.position ) ).Normalized()
-		}
-	{
-	}
+	int left{};
+	int right{};
+	int top{};
+	int bottom{};
 
-	Vertex v0{};
-	Vertex v1{};
-	Vertex v2{};
+	std::vector<uint32_t> triangleIndices{};
 
-	Vector3 normal{};
+	// Farthest depth in every coarse block of the tile and in the whole tile, never closer than the depth buffer
+	std::vector<float> coarseMaxDepths{};
+	float maxDepth{};
+	// Coarse blocks that got partially written, their bound gets tightened once the tile is done
+	uint64_t staleCoarseBlocks{};
 };
 
 struct TriangleOut
@@ -117,31 +118,165 @@ enum class PrimitiveTopology
 	TriangleStrip
 };
 
+// Ends a triangle strip, the next one starts right after it
+constexpr uint32_t RESTART_INDEX{ 0xFFFFFFFF };
+
+// Vertices get projected this many at a time, so the position streams are padded to a multiple of it
+constexpr size_t VERTEX_BATCH_SIZE{ 8 };
+
+// Model space volumes that contain every vertex of a mesh
+struct Bounds
+{
+	Vector3 boxMin{};
+	Vector3 boxMax{};
+	Vector3 sphereCenter{}; // Center of the box, which keeps the sphere close to the smallest one
+	float sphereRadius{};
+};
+
+// Limits of a meshlet, small enough that its triangles face about the same way
+constexpr size_t MESHLET_MAX_VERTICES{ 64 };
+constexpr size_t MESHLET_MAX_TRIANGLES{ 124 };
+
+// Neighbouring triangles of a triangle list that get culled together, see BuildMeshlets
+struct Meshlet
+{
+	uint32_t firstIndex{};
+	uint32_t triangleCount{};
+
+	// The vertex batches its triangles use, as a range of Mesh::meshletBatches
+	uint32_t firstBatch{};
+	uint32_t batchCount{};
+
+	// Model space, the cone holds the normals of all of its triangles
+	Vector3 sphereCenter{};
+	float sphereRadius{};
+	Vector3 coneAxis{};
+	float coneCutoff{}; // Sine of the half angle of the cone, above one when it is too wide to ever face away
+};
+
+// Ends a triangle strip in 16 bit indices, so those address one vertex less
+constexpr uint16_t COMPRESSED_RESTART_INDEX{ 0xFFFF };
+
+// The vertex data of a mesh packed to about a quarter of its size, see CompressMesh
+// The per vertex color is not kept, no mesh that gets loaded has one
+struct CompressedVertices
+{
+	// Model space positions in 65535 steps across the bounding box, split and padded like the float streams
+	std::vector<uint16_t> positionsX{};
+	std::vector<uint16_t> positionsY{};
+	std::vector<uint16_t> positionsZ{};
+	Matrix dequantization{}; // From steps back to model space, gets folded into the model to view matrix
+
+	std::vector<uint32_t> normals{}; // Octahedral, two 16 bit signed normalized values
+	std::vector<uint32_t> tangents{};
+	std::vector<uint32_t> uvs{}; // Two half floats, since texture coordinates are allowed to repeat
+
+	// Only filled when every vertex is addressable with 16 bits, the mesh keeps its 32 bit indices otherwise
+	std::vector<uint16_t> indices{};
+
+	size_t vertexCount{};
+};
+
 struct Mesh
 {
 	std::vector<Vertex> vertices{};
 	std::vector<uint32_t> indices{};
-	std::vector<Vertex> transformedVertices{};
 	PrimitiveTopology primitiveTopology{ PrimitiveTopology::TriangleStrip };
 
-	std::vector<VertexOut> verticesOut{};
+	// Model space positions split per axis, so a batch of vertices loads with one read per axis
+	std::vector<float> positionsX{};
+	std::vector<float> positionsY{};
+	std::vector<float> positionsZ{};
 	Matrix worldMatrix{};
+	uint32_t transformVersion{}; // Changes whenever SetWorldMatrix does
+	Bounds bounds{};
+
+	// Empty unless BuildMeshlets ran, the triangles then get culled a meshlet at a time
+	std::vector<Meshlet> meshlets{};
+	std::vector<uint32_t> meshletBatches{};
+
+	// Replaces the vertices, the position streams and possibly the indices when set
+	CompressedVertices compressed{};
+	bool isCompressed{};
 
 	Texture texture{};
 	Texture normalMap{};
 	Texture specularMap{};
 	Texture glossMap{};
 
-	void UpdateMesh()
+	// Has to run again whenever the model space positions change, as does UpdatePositionStreams
+	void UpdateBounds()
+	{
+		if ( vertices.empty() )
+		{
+			bounds = Bounds{};
+			return;
+		}
+
+		bounds.boxMin = bounds.boxMax = vertices.front().position;
+		for ( const Vertex& vertex : vertices )
+		{
+			bounds.boxMin = { std::min( bounds.boxMin.x, vertex.position.x ),
+							  std::min( bounds.boxMin.y, vertex.position.y ),
+							  std::min( bounds.boxMin.z, vertex.position.z ) };
+			bounds.boxMax = { std::max( bounds.boxMax.x, vertex.position.x ),
+							  std::max( bounds.boxMax.y, vertex.position.y ),
+							  std::max( bounds.boxMax.z, vertex.position.z ) };
+		}
+
+		bounds.sphereCenter = ( bounds.boxMin + bounds.boxMax ) * 0.5f;
+		float sqrRadius{};
+		for ( const Vertex& vertex : vertices )
+		{
+			sqrRadius = std::max( sqrRadius, ( vertex.position - bounds.sphereCenter ).SqrMagnitude() );
+		}
+		bounds.sphereRadius = std::sqrt( sqrRadius );
+	}
+
+	// Has to run again whenever the model space positions change, updates the bounds along with them
+	void UpdatePositionStreams()
 	{
+		UpdateBounds();
+
+		const size_t paddedSize{ ( vertices.size() + VERTEX_BATCH_SIZE - 1 ) / VERTEX_BATCH_SIZE * VERTEX_BATCH_SIZE };
+		positionsX.assign( paddedSize, 0.f );
+		positionsY.assign( paddedSize, 0.f );
+		positionsZ.assign( paddedSize, 0.f );
 		for ( size_t index{}; index < vertices.size(); ++index )
 		{
-			Vertex transformedVertex{ vertices[index] };
-			transformedVertex.position = worldMatrix.TransformPoint( vertices[index].position );
-			transformedVertex.normal = worldMatrix.TransformVector( vertices[index].normal ).Normalized();
-			transformedVertices[index] = transformedVertex;
+			positionsX[index] = vertices[index].position.x;
+			positionsY[index] = vertices[index].position.y;
+			positionsZ[index] = vertices[index].position.z;
 		}
 	}
+
+	size_t GetVertexCount() const noexcept
+	{
+		return isCompressed ? compressed.vertexCount : vertices.size();
+	}
+
+	size_t GetIndexCount() const noexcept
+	{
+		return compressed.indices.empty() ? indices.size() : compressed.indices.size();
+	}
+
+	// Reads either index width, a restart always comes out as RESTART_INDEX
+	uint32_t GetIndex( size_t position ) const noexcept
+	{
+		if ( compressed.indices.empty() )
+		{
+			return indices[position];
+		}
+		const uint16_t index{ compressed.indices[position] };
+		return index == COMPRESSED_RESTART_INDEX ? RESTART_INDEX : index;
+	}
+
+	// The renderer goes straight from model to view space, so a new world matrix only has to be noted
+	void SetWorldMatrix( const Matrix& matrix )
+	{
+		worldMatrix = matrix;
+		++transformVersion;
+	}
 };
 } // namespace dae
 #endif
@@ -0,0 +1,167 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "Vector2.h"
+#include "Vector3.h"
+
+// Everything the deferred resolve needs to know about a pixel, stored compactly
+
+namespace dae
+{
+// Surface attributes of the visible fragment of every pixel, one array per attribute
+// The world position is not stored, the resolve reconstructs it from the depth buffer
+struct GBuffer
+{
+	static constexpr uint16_t NO_MESH{ std::numeric_limits<uint16_t>::max() };
+
+	std::vector<uint16_t> meshIds{}; // Index of the mesh, which doubles as its material
+	std::vector<uint32_t> normals{}; // Octahedral, two 16 bit signed normalized values
+	std::vector<uint32_t> tangents{};
+	std::vector<uint32_t> uvs{}; // Fraction of the texture coordinates as two 16 bit unsigned normalized values
+
+	void Resize( size_t pixelCount )
+	{
+		meshIds.resize( pixelCount );
+		normals.resize( pixelCount );
+		tangents.resize( pixelCount );
+		uvs.resize( pixelCount );
+	}
+
+	// Only the mesh ids need resetting, the other attributes are ignored for pixels without a mesh
+	void Clear() noexcept
+	{
+		std::fill( meshIds.begin(), meshIds.end(), NO_MESH );
+	}
+};
+
+// Visibility buffer entries name the visible triangle instead of describing its surface
+constexpr int VISIBILITY_PRIMITIVE_BITS{ 22 };
+constexpr uint32_t VISIBILITY_PRIMITIVE_MASK{ ( 1u << VISIBILITY_PRIMITIVE_BITS ) - 1 };
+constexpr uint32_t MAX_VISIBILITY_MESHES{ ( 1u << ( 32 - VISIBILITY_PRIMITIVE_BITS ) ) - 1 };
+constexpr uint32_t NO_TRIANGLE{ std::numeric_limits<uint32_t>::max() };
+
+namespace packing
+{
+inline uint32_t PackTriangleId( uint16_t meshId, uint32_t primitiveIndex ) noexcept
+{
+	return ( static_cast<uint32_t>( meshId ) << VISIBILITY_PRIMITIVE_BITS ) | primitiveIndex;
+}
+
+inline uint32_t PackSnorm16x2( float x, float y ) noexcept
+{
+	const auto toSnorm16{ []( float value ) {
+		return static_cast<uint16_t>( static_cast<int16_t>( std::lround( std::clamp( value, -1.f, 1.f ) * 32767.f ) ) );
+	} };
+	return static_cast<uint32_t>( toSnorm16( x ) ) | ( static_cast<uint32_t>( toSnorm16( y ) ) << 16 );
+}
+
+inline Vector2 UnpackSnorm16x2( uint32_t packed ) noexcept
+{
+	constexpr float scale{ 1.f / 32767.f };
+	return { std::max( static_cast<float>( static_cast<int16_t>( packed & 0xFFFFu ) ) * scale, -1.f ),
+			 std::max( static_cast<float>( static_cast<int16_t>( packed >> 16 ) ) * scale, -1.f ) };
+}
+
+// Octahedral mapping, the unit sphere gets folded onto a square
+inline uint32_t PackUnitVector( const Vector3& vector ) noexcept
+{
+	const float inverseLength{ 1.f / ( std::abs( vector.x ) + std::abs( vector.y ) + std::abs( vector.z ) ) };
+	float x{ vector.x * inverseLength };
+	float y{ vector.y * inverseLength };
+	if ( vector.z < 0.f )
+	{
+		const float foldedX{ ( 1.f - std::abs( y ) ) * ( x >= 0.f ? 1.f : -1.f ) };
+		const float foldedY{ ( 1.f - std::abs( x ) ) * ( y >= 0.f ? 1.f : -1.f ) };
+		x = foldedX;
+		y = foldedY;
+	}
+	return PackSnorm16x2( x, y );
+}
+
+inline Vector3 UnpackUnitVector( uint32_t packed ) noexcept
+{
+	const Vector2 folded{ UnpackSnorm16x2( packed ) };
+	Vector3 vector{ folded.x, folded.y, 1.f - std::abs( folded.x ) - std::abs( folded.y ) };
+	const float fold{ std::max( -vector.z, 0.f ) };
+	vector.x += vector.x >= 0.f ? -fold : fold;
+	vector.y += vector.y >= 0.f ? -fold : fold;
+	return vector.Normalized();
+}
+
+// Texture coordinates repeat, so only their fraction tells which texel they land on
+// Sampling wraps in the same way, a texture looks the same whether it gets the coordinates or their fraction
+inline Vector2 WrapTextureCoordinates( const Vector2& uv ) noexcept
+{
+	return { uv.x - std::floor( uv.x ), uv.y - std::floor( uv.y ) };
+}
+
+// For values within [0, 1], a fixed point value spends all of its bits on the range that is used
+inline uint32_t PackUnorm16x2( const Vector2& vector ) noexcept
+{
+	const auto toUnorm16{ []( float value ) {
+		return static_cast<uint32_t>( std::lround( std::clamp( value, 0.f, 1.f ) * 65535.f ) );
+	} };
+	return toUnorm16( vector.x ) | ( toUnorm16( vector.y ) << 16 );
+}
+
+inline Vector2 UnpackUnorm16x2( uint32_t packed ) noexcept
+{
+	constexpr float scale{ 1.f / 65535.f };
+	return { static_cast<float>( packed & 0xFFFFu ) * scale, static_cast<float>( packed >> 16 ) * scale };
+}
+
+// IEEE half float, values too small for it become zero and values too big become infinity
+inline uint16_t PackHalf( float value ) noexcept
+{
+	const uint32_t bits{ std::bit_cast<uint32_t>( value ) };
+	const uint32_t sign{ ( bits >> 16 ) & 0x8000u };
+	const int exponent{ static_cast<int>( ( bits >> 23 ) & 0xFFu ) - 127 + 15 };
+	const uint32_t mantissa{ bits & 0x7FFFFFu };
+	if ( exponent <= 0 )
+	{
+		return static_cast<uint16_t>( sign );
+	}
+	if ( exponent >= 31 )
+	{
+		return static_cast<uint16_t>( sign | 0x7C00u );
+	}
+	// Rounds to nearest, a carry out of the mantissa correctly bumps the exponent
+	const uint32_t half{ sign | ( static_cast<uint32_t>( exponent ) << 10 ) | ( mantissa >> 13 ) };
+	return static_cast<uint16_t>( half + ( ( mantissa >> 12 ) & 1u ) );
+}
+
+inline float UnpackHalf( uint16_t half ) noexcept
+{
+	const uint32_t sign{ static_cast<uint32_t>( half & 0x8000u ) << 16 };
+	const uint32_t exponent{ ( half >> 10 ) & 0x1Fu };
+	const uint32_t mantissa{ half & 0x3FFu };
+	if ( exponent == 0 )
+	{
+		return std::bit_cast<float>( sign ); // PackHalf never makes denormals
+	}
+	if ( exponent == 31 )
+	{
+		return std::bit_cast<float>( sign | 0x7F800000u | ( mantissa << 13 ) );
+	}
+	return std::bit_cast<float>( sign | ( ( exponent + 127 - 15 ) << 23 ) | ( mantissa << 13 ) );
+}
+
+inline uint32_t PackHalf2x16( const Vector2& vector ) noexcept
+{
+	return static_cast<uint32_t>( PackHalf( vector.x ) ) | ( static_cast<uint32_t>( PackHalf( vector.y ) ) << 16 );
+}
+
+inline Vector2 UnpackHalf2x16( uint32_t packed ) noexcept
+{
+	return { UnpackHalf( static_cast<uint16_t>( packed & 0xFFFFu ) ), UnpackHalf( static_cast<uint16_t>( packed >> 16 ) ) };
+}
+} // namespace packing
+} // namespace dae
+
+#endif
@@ -0,0 +1,593 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <unordered_map>
+#include "GBuffer.h"
+
+namespace dae
+{
+namespace
+{
+constexpr uint32_t NO_VERTEX{ std::numeric_limits<uint32_t>::max() };
+constexpr uint32_t NO_CANDIDATE{ std::numeric_limits<uint32_t>::max() };
+
+// How many new vertices a meshlet would rather take than a triangle facing the other way
+constexpr float MESHLET_CONE_WEIGHT{ 2.f };
+// Triangles that deviate more from the average normal start a new meshlet, which keeps the cones narrow enough to cull
+// Looser limits make fewer meshlets, but on the vehicle culling drops from a third of the triangles to a fifth at 0.7
+constexpr float MESHLET_MIN_NORMAL_DOT{ 0.9f };
+// Triangles after the seed that a meshlet without neighbours left picks its next one from
+constexpr size_t MESHLET_FALLBACK_WINDOW{ 64 };
+
+uint64_t GetEdgeKey( uint32_t from, uint32_t to ) noexcept
+{
+	return ( static_cast<uint64_t>( from ) << 32 ) | to;
+}
+
+// Triangles that use every vertex, as offsets into one shared array
+struct VertexAdjacency
+{
+	std::vector<uint32_t> offsets{};
+	std::vector<uint32_t> triangles{};
+
+	VertexAdjacency( const std::vector<uint32_t>& indices, size_t vertexCount )
+		: offsets( vertexCount + 1 )
+		, triangles( indices.size() )
+	{
+		for ( const uint32_t index : indices )
+		{
+			++offsets[index + 1];
+		}
+		for ( size_t vertex{}; vertex < vertexCount; ++vertex )
+		{
+			offsets[vertex + 1] += offsets[vertex];
+		}
+
+		std::vector<uint32_t> fill{ offsets.begin(), offsets.end() - 1 };
+		for ( size_t index{}; index < indices.size(); ++index )
+		{
+			triangles[fill[indices[index]]++] = static_cast<uint32_t>( index / 3 );
+		}
+	}
+};
+} // namespace
+
+float GetACMR( const std::vector<uint32_t>& indices, PrimitiveTopology topology )
+{
+	std::deque<uint32_t> cache{};
+	size_t misses{};
+	size_t triangleCount{};
+
+	const auto fetch{ [&]( uint32_t vertex ) {
+		if ( std::find( cache.begin(), cache.end(), vertex ) != cache.end() )
+		{
+			return;
+		}
+		++misses;
+		cache.push_back( vertex );
+		if ( cache.size() > VERTEX_CACHE_SIZE )
+		{
+			cache.pop_front();
+		}
+	} };
+
+	const size_t step{ topology == PrimitiveTopology::TriangleList ? size_t{ 3 } : size_t{ 1 } };
+	for ( size_t index{}; index + 2 < indices.size(); index += step )
+	{
+		const std::array<uint32_t, 3> triangle{ indices[index], indices[index + 1], indices[index + 2] };
+		// Strips connect through restarts, the triangles that span one do not exist
+		if ( std::find( triangle.begin(), triangle.end(), RESTART_INDEX ) != triangle.end() )
+		{
+			continue;
+		}
+		for ( const uint32_t vertex : triangle )
+		{
+			fetch( vertex );
+		}
+		++triangleCount;
+	}
+
+	return triangleCount ? static_cast<float>( misses ) / triangleCount : 0.f;
+}
+
+void OptimizeVertexCache( std::vector<uint32_t>& indices, size_t vertexCount )
+{
+	assert( indices.size() % 3 == 0 && "Vertex cache optimization expects a triangle list" );
+	if ( indices.empty() )
+	{
+		return;
+	}
+
+	const VertexAdjacency adjacency{ indices, vertexCount };
+	const size_t triangleCount{ indices.size() / 3 };
+
+	std::vector<uint32_t> liveTriangles( vertexCount );
+	for ( uint32_t vertex{}; vertex < vertexCount; ++vertex )
+	{
+		liveTriangles[vertex] = adjacency.offsets[vertex + 1] - adjacency.offsets[vertex];
+	}
+
+	// A vertex is still in the cache when less than VERTEX_CACHE_SIZE vertices missed since its time stamp
+	std::vector<int> cacheTimeStamps( vertexCount );
+	int time{ VERTEX_CACHE_SIZE + 1 };
+
+	std::vector<bool> isEmitted( triangleCount );
+	std::vector<uint32_t> deadEnds{};
+	std::vector<uint32_t> candidates{};
+	std::vector<uint32_t> indicesOut{};
+	indicesOut.reserve( indices.size() );
+
+	// When the candidates run out, go back to the most recent vertex that still has triangles left, or else the next one in order
+	uint32_t cursor{};
+	const auto skipDeadEnd{ [&]() {
+		while ( !deadEnds.empty() )
+		{
+			const uint32_t vertex{ deadEnds.back() };
+			deadEnds.pop_back();
+			if ( liveTriangles[vertex] > 0 )
+			{
+				return vertex;
+			}
+		}
+		for ( ; cursor < vertexCount; ++cursor )
+		{
+			if ( liveTriangles[cursor] > 0 )
+			{
+				return cursor;
+			}
+		}
+		return NO_VERTEX;
+	} };
+
+	uint32_t fanVertex{ skipDeadEnd() };
+	while ( fanVertex != NO_VERTEX )
+	{
+		candidates.clear();
+		for ( uint32_t offset{ adjacency.offsets[fanVertex] }; offset < adjacency.offsets[fanVertex + 1]; ++offset )
+		{
+			const uint32_t triangle{ adjacency.triangles[offset] };
+			if ( isEmitted[triangle] )
+			{
+				continue;
+			}
+			isEmitted[triangle] = true;
+
+			for ( size_t corner{}; corner < 3; ++corner )
+			{
+				const uint32_t vertex{ indices[triangle * 3 + corner] };
+				indicesOut.push_back( vertex );
+				deadEnds.push_back( vertex );
+				candidates.push_back( vertex );
+				--liveTriangles[vertex];
+				if ( time - cacheTimeStamps[vertex] > VERTEX_CACHE_SIZE )
+				{
+					cacheTimeStamps[vertex] = time++;
+				}
+			}
+		}
+
+		// Next fan around the candidate that will still be cached once all of its triangles are done, oldest first
+		uint32_t nextVertex{ NO_VERTEX };
+		int bestPriority{ -1 };
+		for ( const uint32_t vertex : candidates )
+		{
+			if ( liveTriangles[vertex] == 0 )
+			{
+				continue;
+			}
+			int priority{};
+			const int age{ time - cacheTimeStamps[vertex] };
+			if ( age + 2 * static_cast<int>( liveTriangles[vertex] ) <= VERTEX_CACHE_SIZE )
+			{
+				priority = age;
+			}
+			if ( priority > bestPriority )
+			{
+				bestPriority = priority;
+				nextVertex = vertex;
+			}
+		}
+		fanVertex = nextVertex != NO_VERTEX ? nextVertex : skipDeadEnd();
+	}
+
+	indices = std::move( indicesOut );
+}
+
+void OptimizeVertexFetch( std::vector<Vertex>& vertices, std::vector<uint32_t>& indices )
+{
+	std::vector<uint32_t> remap( vertices.size(), NO_VERTEX );
+	std::vector<Vertex> verticesOut{};
+	verticesOut.reserve( vertices.size() );
+
+	for ( uint32_t& index : indices )
+	{
+		if ( index == RESTART_INDEX )
+		{
+			continue;
+		}
+		if ( remap[index] == NO_VERTEX )
+		{
+			remap[index] = static_cast<uint32_t>( verticesOut.size() );
+			verticesOut.push_back( vertices[index] );
+		}
+		index = remap[index];
+	}
+
+	vertices = std::move( verticesOut );
+}
+
+std::vector<uint32_t> Stripify( const std::vector<uint32_t>& indices )
+{
+	assert( indices.size() % 3 == 0 && "Stripification expects a triangle list" );
+	const size_t triangleCount{ indices.size() / 3 };
+
+	// Every triangle under each of its edges, in the direction of its winding
+	std::unordered_multimap<uint64_t, uint32_t> edgeTriangles{};
+	edgeTriangles.reserve( indices.size() );
+	for ( uint32_t triangle{}; triangle < triangleCount; ++triangle )
+	{
+		for ( size_t corner{}; corner < 3; ++corner )
+		{
+			const uint32_t from{ indices[triangle * 3 + corner] };
+			const uint32_t to{ indices[triangle * 3 + ( corner + 1 ) % 3] };
+			edgeTriangles.emplace( GetEdgeKey( from, to ), triangle );
+		}
+	}
+
+	std::vector<bool> isEmitted( triangleCount );
+	const auto findTriangle{ [&]( uint32_t from, uint32_t to ) {
+		const auto [first, last] = edgeTriangles.equal_range( GetEdgeKey( from, to ) );
+		for ( auto it{ first }; it != last; ++it )
+		{
+			if ( !isEmitted[it->second] )
+			{
+				return it->second;
+			}
+		}
+		return NO_VERTEX;
+	} };
+
+	// The corner of a triangle that is not on the given edge
+	const auto getThirdVertex{ [&]( uint32_t triangle, uint32_t from, uint32_t to ) {
+		for ( size_t corner{}; corner < 3; ++corner )
+		{
+			const uint32_t vertex{ indices[triangle * 3 + corner] };
+			if ( vertex != from && vertex != to )
+			{
+				return vertex;
+			}
+		}
+		return indices[triangle * 3];
+	} };
+
+	std::vector<uint32_t> strips{};
+	strips.reserve( indices.size() );
+	for ( uint32_t seed{}; seed < triangleCount; ++seed )
+	{
+		if ( isEmitted[seed] )
+		{
+			continue;
+		}
+		isEmitted[seed] = true;
+
+		// Start with the rotation that can be continued, the second triangle of a strip lies across the edge from the last to the second vertex
+		std::array<uint32_t, 3> triangle{ indices[seed * 3], indices[seed * 3 + 1], indices[seed * 3 + 2] };
+		for ( int rotation{}; rotation < 3; ++rotation )
+		{
+			if ( findTriangle( triangle[2], triangle[1] ) != NO_VERTEX )
+			{
+				break;
+			}
+			std::rotate( triangle.begin(), triangle.begin() + 1, triangle.end() );
+		}
+
+		if ( !strips.empty() )
+		{
+			strips.push_back( RESTART_INDEX );
+		}
+		strips.insert( strips.end(), triangle.begin(), triangle.end() );
+
+		// Odd triangles in a strip have their winding flipped, so they have to share the last edge the other way around
+		for ( bool isOdd{ true };; isOdd = !isOdd )
+		{
+			const uint32_t secondToLast{ strips[strips.size() - 2] };
+			const uint32_t last{ strips.back() };
+			const uint32_t next{ isOdd ? findTriangle( last, secondToLast ) : findTriangle( secondToLast, last ) };
+			if ( next == NO_VERTEX )
+			{
+				break;
+			}
+			isEmitted[next] = true;
+			strips.push_back( getThirdVertex( next, secondToLast, last ) );
+		}
+	}
+
+	return strips;
+}
+
+VertexCacheStatistics OptimizeMesh( Mesh& mesh, bool makeStrips )
+{
+	assert( mesh.primitiveTopology == PrimitiveTopology::TriangleList && "Only triangle lists can be optimized" );
+
+	VertexCacheStatistics statistics{};
+	statistics.acmrBefore = GetACMR( mesh.indices, mesh.primitiveTopology );
+
+	OptimizeVertexCache( mesh.indices, mesh.vertices.size() );
+	if ( makeStrips )
+	{
+		mesh.indices = Stripify( mesh.indices );
+		mesh.primitiveTopology = PrimitiveTopology::TriangleStrip;
+	}
+	OptimizeVertexFetch( mesh.vertices, mesh.indices );
+
+	statistics.acmrAfter = GetACMR( mesh.indices, mesh.primitiveTopology );
+	return statistics;
+}
+
+void BuildMeshlets( Mesh& mesh )
+{
+	assert( mesh.primitiveTopology == PrimitiveTopology::TriangleList && "Only triangle lists can be split into meshlets" );
+	assert( !mesh.isCompressed && "Meshlets have to be built from the full vertices" );
+
+	const size_t vertexCount{ mesh.vertices.size() };
+	const size_t triangleCount{ mesh.indices.size() / 3 };
+	const VertexAdjacency adjacency{ mesh.indices, vertexCount };
+
+	// Faces point where their winding is clockwise, which is what the renderer culls by
+	const auto getFaceNormal{ [&]( const std::vector<uint32_t>& indices, size_t triangle ) {
+		const Vector3& position0{ mesh.vertices[indices[triangle * 3 + 0]].position };
+		const Vector3& position1{ mesh.vertices[indices[triangle * 3 + 1]].position };
+		const Vector3& position2{ mesh.vertices[indices[triangle * 3 + 2]].position };
+		const Vector3 normal{ Vector3::Cross( position1 - position0, position2 - position0 ) };
+		const float length{ normal.Magnitude() };
+		return length > 0.f ? normal / length : Vector3{};
+	} };
+	std::vector<Vector3> faceNormals( triangleCount );
+	for ( size_t triangle{}; triangle < triangleCount; ++triangle )
+	{
+		faceNormals[triangle] = getFaceNormal( mesh.indices, triangle );
+	}
+
+	// Which meshlet last used every vertex, so its vertices are counted only once
+	std::vector<uint32_t> vertexMeshlets( vertexCount, NO_VERTEX );
+	std::vector<uint32_t> meshletVertices{};
+	meshletVertices.reserve( MESHLET_MAX_VERTICES );
+	std::vector<bool> isEmitted( triangleCount );
+	std::vector<uint32_t> indicesOut{};
+	indicesOut.reserve( mesh.indices.size() );
+	mesh.meshlets.clear();
+
+	// Grows every meshlet from a seed over the triangles next to it, preferring the ones that add few vertices
+	// and face the same way as what it has so far, so its normal cone stays narrow
+	size_t seed{};
+	while ( true )
+	{
+		// The cache optimized order keeps the next seed close to the previous meshlet
+		while ( seed < triangleCount && isEmitted[seed] )
+		{
+			++seed;
+		}
+		if ( seed == triangleCount )
+		{
+			break;
+		}
+
+		const uint32_t meshletIndex{ static_cast<uint32_t>( mesh.meshlets.size() ) };
+		Meshlet meshlet{};
+		meshlet.firstIndex = static_cast<uint32_t>( indicesOut.size() );
+		Vector3 normalSum{};
+		uint32_t next{ static_cast<uint32_t>( seed ) };
+		while ( next != NO_CANDIDATE )
+		{
+			isEmitted[next] = true;
+			for ( size_t corner{}; corner < 3; ++corner )
+			{
+				const uint32_t vertex{ mesh.indices[next * size_t{ 3 } + corner] };
+				indicesOut.push_back( vertex );
+				if ( vertexMeshlets[vertex] != meshletIndex )
+				{
+					vertexMeshlets[vertex] = meshletIndex;
+					meshletVertices.push_back( vertex );
+				}
+			}
+			normalSum += faceNormals[next];
+			if ( ++meshlet.triangleCount == MESHLET_MAX_TRIANGLES )
+			{
+				break;
+			}
+
+			const Vector3 axis{ normalSum.SqrMagnitude() > 0.f ? normalSum.Normalized() : Vector3{} };
+			float bestScore{ std::numeric_limits<float>::max() };
+			next = NO_CANDIDATE;
+			for ( const uint32_t vertex : meshletVertices )
+			{
+				for ( uint32_t offset{ adjacency.offsets[vertex] }; offset < adjacency.offsets[vertex + 1]; ++offset )
+				{
+					const uint32_t candidate{ adjacency.triangles[offset] };
+					if ( isEmitted[candidate] )
+					{
+						continue;
+					}
+					const auto newVertexCount{ std::count_if( mesh.indices.begin() + candidate * size_t{ 3 },
+															  mesh.indices.begin() + candidate * size_t{ 3 } + 3,
+															  [&]( uint32_t corner ) {
+																  return vertexMeshlets[corner] != meshletIndex;
+															  } ) };
+					if ( meshletVertices.size() + newVertexCount > MESHLET_MAX_VERTICES ||
+						 Vector3::Dot( faceNormals[candidate], axis ) < MESHLET_MIN_NORMAL_DOT )
+					{
+						continue;
+					}
+					const float score{ static_cast<float>( newVertexCount ) +
+									   MESHLET_CONE_WEIGHT * ( 1.f - Vector3::Dot( faceNormals[candidate], axis ) ) };
+					if ( score < bestScore )
+					{
+						bestScore = score;
+						next = candidate;
+					}
+				}
+			}
+
+			// Seams split vertices, so the meshlet can run out of neighbours long before it is full
+			// It then continues with whichever of the next triangles in cache order fits it best
+			if ( next == NO_CANDIDATE && meshletVertices.size() + 3 <= MESHLET_MAX_VERTICES )
+			{
+				size_t lookedAt{};
+				for ( size_t candidate{ seed }; candidate < triangleCount && lookedAt < MESHLET_FALLBACK_WINDOW; ++candidate )
+				{
+					if ( isEmitted[candidate] )
+					{
+						continue;
+					}
+					++lookedAt;
+					if ( Vector3::Dot( faceNormals[candidate], axis ) < MESHLET_MIN_NORMAL_DOT )
+					{
+						continue;
+					}
+					const float score{ MESHLET_CONE_WEIGHT * ( 1.f - Vector3::Dot( faceNormals[candidate], axis ) ) };
+					if ( score < bestScore )
+					{
+						bestScore = score;
+						next = static_cast<uint32_t>( candidate );
+					}
+				}
+			}
+		}
+
+		mesh.meshlets.push_back( meshlet );
+		meshletVertices.clear();
+	}
+	mesh.indices = std::move( indicesOut );
+
+	// Vertices in the order the meshlets use them, so every meshlet needs few vertex batches
+	OptimizeVertexFetch( mesh.vertices, mesh.indices );
+
+	std::vector<uint32_t> meshletBatches{};
+	mesh.meshletBatches.clear();
+	for ( Meshlet& meshlet : mesh.meshlets )
+	{
+		const size_t firstTriangle{ meshlet.firstIndex / size_t{ 3 } };
+		const size_t endTriangle{ firstTriangle + meshlet.triangleCount };
+		const auto firstIndex{ mesh.indices.begin() + meshlet.firstIndex };
+		const auto endIndex{ firstIndex + meshlet.triangleCount * size_t{ 3 } };
+
+		// Sphere around the center of the box of its vertices
+		Vector3 boxMin{ mesh.vertices[*firstIndex].position };
+		Vector3 boxMax{ boxMin };
+		for ( auto index{ firstIndex }; index != endIndex; ++index )
+		{
+			const Vector3& position{ mesh.vertices[*index].position };
+			boxMin = { std::min( boxMin.x, position.x ), std::min( boxMin.y, position.y ), std::min( boxMin.z, position.z ) };
+			boxMax = { std::max( boxMax.x, position.x ), std::max( boxMax.y, position.y ), std::max( boxMax.z, position.z ) };
+		}
+		meshlet.sphereCenter = ( boxMin + boxMax ) * 0.5f;
+		float sqrRadius{};
+		for ( auto index{ firstIndex }; index != endIndex; ++index )
+		{
+			sqrRadius = std::max( sqrRadius, ( mesh.vertices[*index].position - meshlet.sphereCenter ).SqrMagnitude() );
+		}
+		meshlet.sphereRadius = std::sqrt( sqrRadius );
+
+		// Cone around the average normal, wide enough for the normal that deviates most
+		Vector3 normalSum{};
+		for ( size_t triangle{ firstTriangle }; triangle < endTriangle; ++triangle )
+		{
+			normalSum += getFaceNormal( mesh.indices, triangle );
+		}
+		float minDot{ -1.f };
+		if ( normalSum.SqrMagnitude() > 0.f )
+		{
+			meshlet.coneAxis = normalSum.Normalized();
+			minDot = 1.f;
+			for ( size_t triangle{ firstTriangle }; triangle < endTriangle; ++triangle )
+			{
+				const Vector3 normal{ getFaceNormal( mesh.indices, triangle ) };
+				if ( normal.SqrMagnitude() > 0.f )
+				{
+					minDot = std::min( minDot, Vector3::Dot( normal, meshlet.coneAxis ) );
+				}
+			}
+		}
+		meshlet.coneCutoff = minDot > 0.f ? std::sqrt( 1.f - minDot * minDot ) : 2.f;
+
+		// Vertex batches it needs projected
+		meshletBatches.clear();
+		for ( auto index{ firstIndex }; index != endIndex; ++index )
+		{
+			meshletBatches.push_back( static_cast<uint32_t>( *index / VERTEX_BATCH_SIZE ) );
+		}
+		std::sort( meshletBatches.begin(), meshletBatches.end() );
+		meshletBatches.erase( std::unique( meshletBatches.begin(), meshletBatches.end() ), meshletBatches.end() );
+		meshlet.firstBatch = static_cast<uint32_t>( mesh.meshletBatches.size() );
+		meshlet.batchCount = static_cast<uint32_t>( meshletBatches.size() );
+		mesh.meshletBatches.insert( mesh.meshletBatches.end(), meshletBatches.begin(), meshletBatches.end() );
+	}
+}
+
+void CompressMesh( Mesh& mesh )
+{
+	assert( !mesh.isCompressed && "Mesh is already compressed" );
+
+	const size_t vertexCount{ mesh.vertices.size() };
+	const size_t paddedSize{ ( vertexCount + VERTEX_BATCH_SIZE - 1 ) / VERTEX_BATCH_SIZE * VERTEX_BATCH_SIZE };
+
+	// The steps get spread over the extent of the bounding box on every axis
+	mesh.UpdateBounds();
+	const Vector3& boundsMin{ mesh.bounds.boxMin };
+	const Vector3 boundsSize{ mesh.bounds.boxMax - mesh.bounds.boxMin };
+
+	constexpr float steps{ std::numeric_limits<uint16_t>::max() };
+	// A flat axis has nothing to spread, all of its vertices sit on step zero
+	const auto quantize{ [&]( float value, float min, float size ) {
+		return static_cast<uint16_t>( size > 0.f ? std::lround( ( value - min ) / size * steps ) : 0 );
+	} };
+
+	// Vertices of triangles without texture coordinates never got a tangent, they pack into the zero bits
+	const auto packDirection{ []( const Vector3& direction ) {
+		return direction.SqrMagnitude() > 0.f ? packing::PackUnitVector( direction ) : 0u;
+	} };
+
+	CompressedVertices& compressed{ mesh.compressed };
+	compressed.positionsX.assign( paddedSize, 0 );
+	compressed.positionsY.assign( paddedSize, 0 );
+	compressed.positionsZ.assign( paddedSize, 0 );
+	compressed.normals.resize( vertexCount );
+	compressed.tangents.resize( vertexCount );
+	compressed.uvs.resize( vertexCount );
+	for ( size_t index{}; index < vertexCount; ++index )
+	{
+		const Vertex& vertex{ mesh.vertices[index] };
+		compressed.positionsX[index] = quantize( vertex.position.x, boundsMin.x, boundsSize.x );
+		compressed.positionsY[index] = quantize( vertex.position.y, boundsMin.y, boundsSize.y );
+		compressed.positionsZ[index] = quantize( vertex.position.z, boundsMin.z, boundsSize.z );
+		compressed.normals[index] = packDirection( vertex.normal );
+		compressed.tangents[index] = packDirection( vertex.tangent );
+		compressed.uvs[index] = packing::PackHalf2x16( vertex.uv );
+	}
+	compressed.dequantization = Matrix{ Vector3{ boundsSize.x / steps, 0.f, 0.f },
+										Vector3{ 0.f, boundsSize.y / steps, 0.f },
+										Vector3{ 0.f, 0.f, boundsSize.z / steps },
+										boundsMin };
+	compressed.vertexCount = vertexCount;
+
+	// The restart index takes the last 16 bit value, so only one vertex less fits
+	if ( vertexCount <= COMPRESSED_RESTART_INDEX )
+	{
+		compressed.indices.resize( mesh.indices.size() );
+		std::transform( mesh.indices.begin(), mesh.indices.end(), compressed.indices.begin(), []( uint32_t index ) {
+			return index == RESTART_INDEX ? COMPRESSED_RESTART_INDEX : static_cast<uint16_t>( index );
+		} );
+		mesh.indices = std::vector<uint32_t>{};
+	}
+
+	mesh.vertices = std::vector<Vertex>{};
+	mesh.positionsX = std::vector<float>{};
+	mesh.positionsY = std::vector<float>{};
+	mesh.positionsZ = std::vector<float>{};
+	mesh.isCompressed = true;
+}
+} // namespace dae
@@ -0,0 +1,49 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <cstdint>
+#include <vector>
+#include "DataTypes.h"
+
+// Load time reordering of mesh data, so neighbouring triangles reuse the vertices that were fetched last
+
+namespace dae
+{
+// Size of the simulated first in, first out vertex cache
+constexpr int VERTEX_CACHE_SIZE{ 16 };
+
+// Average amount of vertices every triangle misses in the vertex cache, between 0.5 and 3 with lower being better
+float GetACMR( const std::vector<uint32_t>& indices, PrimitiveTopology topology );
+
+// Tipsify, emits the triangles around one vertex after the other while keeping the vertices they share in the cache
+// Expects a triangle list, the winding of every triangle stays as it is
+void OptimizeVertexCache( std::vector<uint32_t>& indices, size_t vertexCount );
+
+// Orders the vertices the way the indices first use them, vertices no triangle uses get dropped
+void OptimizeVertexFetch( std::vector<Vertex>& vertices, std::vector<uint32_t>& indices );
+
+// Greedily chains neighbouring triangles of a list into strips, separated by RESTART_INDEX
+std::vector<uint32_t> Stripify( const std::vector<uint32_t>& indices );
+
+// The ACMR of a mesh before and after OptimizeMesh, to tell how much it helped
+struct VertexCacheStatistics
+{
+	float acmrBefore{};
+	float acmrAfter{};
+};
+
+// Runs all of the above on a triangle list mesh
+// Has to happen before the position streams get built
+[[nodiscard]] VertexCacheStatistics OptimizeMesh( Mesh& mesh, bool makeStrips );
+
+// Greedily grows meshlets of neighbouring triangles that face about the same way, seeded in the order of the triangles
+// so it best runs after OptimizeMesh. The triangles get regrouped so every meshlet is a range of the indices,
+// and the vertices reordered so every meshlet touches few vertex batches
+void BuildMeshlets( Mesh& mesh );
+
+// Packs the vertices and indices into mesh.compressed and frees the full size copies
+// Takes the place of UpdatePositionStreams, so it comes after every other change to the vertices
+void CompressMesh( Mesh& mesh );
+} // namespace dae
+
+#endif
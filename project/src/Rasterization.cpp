@@ -0,0 +1,451 @@
+#include "Rasterization.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#if defined( SIMD_AVX2 )
+#	include <immintrin.h>
+#elif defined( SIMD_SSE )
+#	include <emmintrin.h>
+#endif
+
+namespace dae
+{
+namespace
+{
+struct FixedPoint
+{
+	int64_t x{};
+	int64_t y{};
+};
+
+constexpr int64_t HALF_PIXEL{ SUBPIXEL_SCALE / 2 };
+
+FixedPoint ToFixedPoint( const Vector4& position ) noexcept
+{
+	return { std::llround( position.x * SUBPIXEL_SCALE ), std::llround( position.y * SUBPIXEL_SCALE ) };
+}
+
+EdgeFunction SetupEdge( const FixedPoint& from, const FixedPoint& to ) noexcept
+{
+	// Cross( to - from, pixel - from ), positive on the inner side of the edge
+	const int64_t a{ from.y - to.y };
+	const int64_t b{ to.x - from.x };
+
+	// Top-left fill rule: a pixel center exactly on the edge only belongs to the triangle if this is a left edge
+	// (inside lies to the right) or a top edge (horizontal with the inside below it)
+	const bool isTopLeft{ a > 0 || ( a == 0 && b > 0 ) };
+
+	EdgeFunction edge{};
+	edge.stepX = a * SUBPIXEL_SCALE;
+	edge.stepY = b * SUBPIXEL_SCALE;
+	edge.origin = a * ( HALF_PIXEL - from.x ) + b * ( HALF_PIXEL - from.y ) - ( isTopLeft ? 0 : 1 );
+
+	return edge;
+}
+
+// Plane through the values at the three vertices, from the vertex offsets relative to the first one
+AttributePlane SetupPlane( float value0,
+						   float value1,
+						   float value2,
+						   const Vector2& edge1,
+						   const Vector2& edge2,
+						   float inverseDoubleArea ) noexcept
+{
+	const float delta1{ value1 - value0 };
+	const float delta2{ value2 - value0 };
+	return { value0,
+			 ( delta1 * edge2.y - delta2 * edge1.y ) * inverseDoubleArea,
+			 ( delta2 * edge1.x - delta1 * edge2.x ) * inverseDoubleArea };
+}
+
+int GetLaneOffset( int lane, int depthPitch ) noexcept
+{
+	return ( lane % BLOCK_WIDTH ) + ( lane / BLOCK_WIDTH ) * depthPitch;
+}
+
+#if defined( SIMD_AVX2 ) || defined( SIMD_SSE )
+// Far away from the triangle only the sign of an edge value matters, and that survives clamping to 32 bits
+int32_t ClampEdgeValue( int64_t value ) noexcept
+{
+	constexpr int64_t limit{ 1 << 30 };
+	return static_cast<int32_t>( std::clamp( value, -limit, limit ) );
+}
+
+// Partial blocks can hang over the edge of the buffer, so only touch the lanes in the mask
+void GatherDepths( const float* pDepth, int depthPitch, uint32_t laneMask, float* pOut ) noexcept
+{
+	for ( int lane{}; lane < BLOCK_SIZE; ++lane )
+	{
+		pOut[lane] = ( laneMask & ( 1u << lane ) ) ? pDepth[GetLaneOffset( lane, depthPitch )] : 0.f;
+	}
+}
+
+void ScatterDepths( const float* pDepths, uint32_t laneMask, float* pDepth, int depthPitch ) noexcept
+{
+	while ( laneMask )
+	{
+		const int lane{ std::countr_zero( laneMask ) };
+		laneMask &= laneMask - 1;
+		pDepth[GetLaneOffset( lane, depthPitch )] = pDepths[lane];
+	}
+}
+#endif
+} // namespace
+
+bool SetupTriangle( const TriangleOut& triangle, TriangleSetup& setup ) noexcept
+{
+	const std::array<FixedPoint, 3> vertices{ ToFixedPoint( triangle.v0.position ),
+											  ToFixedPoint( triangle.v1.position ),
+											  ToFixedPoint( triangle.v2.position ) };
+
+	const int64_t doubleArea{ ( vertices[1].x - vertices[0].x ) * ( vertices[2].y - vertices[0].y ) -
+							  ( vertices[1].y - vertices[0].y ) * ( vertices[2].x - vertices[0].x ) };
+
+	// Zero area after snapping or wound the wrong way
+	if ( doubleArea <= 0 )
+	{
+		return false;
+	}
+
+	setup.edges[0] = SetupEdge( vertices[1], vertices[2] );
+	setup.edges[1] = SetupEdge( vertices[2], vertices[0] );
+	setup.edges[2] = SetupEdge( vertices[0], vertices[1] );
+	setup.inverseDoubleArea = 1.f / static_cast<float>( doubleArea );
+	setup.minDepth = std::min( { triangle.v0.position.z, triangle.v1.position.z, triangle.v2.position.z } );
+	setup.maxDepth = std::max( { triangle.v0.position.z, triangle.v1.position.z, triangle.v2.position.z } );
+
+	const int64_t minX{ std::min( { vertices[0].x, vertices[1].x, vertices[2].x } ) };
+	const int64_t maxX{ std::max( { vertices[0].x, vertices[1].x, vertices[2].x } ) };
+	const int64_t minY{ std::min( { vertices[0].y, vertices[1].y, vertices[2].y } ) };
+	const int64_t maxY{ std::max( { vertices[0].y, vertices[1].y, vertices[2].y } ) };
+
+	// Only pixels whose center lies within the snapped bounds can be covered
+	setup.left = static_cast<int>( ( minX - HALF_PIXEL + SUBPIXEL_SCALE - 1 ) >> SUBPIXEL_BITS );
+	setup.right = static_cast<int>( ( ( maxX - HALF_PIXEL ) >> SUBPIXEL_BITS ) + 1 );
+	setup.top = static_cast<int>( ( minY - HALF_PIXEL + SUBPIXEL_SCALE - 1 ) >> SUBPIXEL_BITS );
+	setup.bottom = static_cast<int>( ( ( maxY - HALF_PIXEL ) >> SUBPIXEL_BITS ) + 1 );
+
+	return true;
+}
+
+BlockSetup SetupBlock( const TriangleSetup& setup, const TriangleOut& triangle ) noexcept
+{
+	BlockSetup blockSetup{};
+	for ( int lane{}; lane < BLOCK_SIZE; ++lane )
+	{
+		const int laneX{ lane % BLOCK_WIDTH };
+		const int laneY{ lane / BLOCK_WIDTH };
+		for ( size_t edgeIndex{}; edgeIndex < setup.edges.size(); ++edgeIndex )
+		{
+			const EdgeFunction& edge{ setup.edges[edgeIndex] };
+			blockSetup.edgeOffsets[edgeIndex][lane] = static_cast<int32_t>( edge.stepX * laneX + edge.stepY * laneY );
+		}
+		for ( size_t weightIndex{}; weightIndex < blockSetup.weightOffsets.size(); ++weightIndex )
+		{
+			blockSetup.weightOffsets[weightIndex][lane] =
+				static_cast<float>( blockSetup.edgeOffsets[weightIndex][lane] ) * setup.inverseDoubleArea;
+		}
+	}
+
+	blockSetup.depths = { triangle.v0.position.z, triangle.v1.position.z, triangle.v2.position.z };
+	blockSetup.inverseViewDepths = { 1.f / triangle.v0.position.w,
+									 1.f / triangle.v1.position.w,
+									 1.f / triangle.v2.position.w };
+	blockSetup.inverseDoubleArea = setup.inverseDoubleArea;
+
+	return blockSetup;
+}
+
+AttributePlanes SetupAttributePlanes( const TriangleOut& triangle ) noexcept
+{
+	// Same snapped positions as the edge functions, so the planes agree with the coverage
+	const FixedPoint vertex0{ ToFixedPoint( triangle.v0.position ) };
+	const FixedPoint vertex1{ ToFixedPoint( triangle.v1.position ) };
+	const FixedPoint vertex2{ ToFixedPoint( triangle.v2.position ) };
+	constexpr float inverseScale{ 1.f / SUBPIXEL_SCALE };
+	const Vector2 edge1{ static_cast<float>( vertex1.x - vertex0.x ) * inverseScale,
+						 static_cast<float>( vertex1.y - vertex0.y ) * inverseScale };
+	const Vector2 edge2{ static_cast<float>( vertex2.x - vertex0.x ) * inverseScale,
+						 static_cast<float>( vertex2.y - vertex0.y ) * inverseScale };
+	const float inverseDoubleArea{ 1.f / ( edge1.x * edge2.y - edge1.y * edge2.x ) };
+
+	AttributePlanes planes{};
+	planes.originX = static_cast<float>( vertex0.x ) * inverseScale;
+	planes.originY = static_cast<float>( vertex0.y ) * inverseScale;
+
+	auto setupPlane{ [&]( float value0, float value1, float value2 ) {
+		return SetupPlane( value0, value1, value2, edge1, edge2, inverseDoubleArea );
+	} };
+
+	for ( int axis{}; axis < 3; ++axis )
+	{
+		planes.normal[axis] = setupPlane( triangle.v0.normal[axis], triangle.v1.normal[axis], triangle.v2.normal[axis] );
+		planes.tangent[axis] = setupPlane( triangle.v0.tangent[axis], triangle.v1.tangent[axis], triangle.v2.tangent[axis] );
+	}
+
+	const float inverseW0{ 1.f / triangle.v0.position.w };
+	const float inverseW1{ 1.f / triangle.v1.position.w };
+	const float inverseW2{ 1.f / triangle.v2.position.w };
+	planes.uvOverW[0] = setupPlane( triangle.v0.uv.x * inverseW0, triangle.v1.uv.x * inverseW1, triangle.v2.uv.x * inverseW2 );
+	planes.uvOverW[1] = setupPlane( triangle.v0.uv.y * inverseW0, triangle.v1.uv.y * inverseW1, triangle.v2.uv.y * inverseW2 );
+
+	return planes;
+}
+
+RegionCoverage GetRegionCoverage( const TriangleSetup& setup, int left, int top, int right, int bottom ) noexcept
+{
+	bool isFullyCovered{ true };
+	for ( const EdgeFunction& edge : setup.edges )
+	{
+		// The pixel centers with the lowest and highest value of this edge are opposite corners of the region
+		const int64_t cornerValue{ edge.Evaluate( left, top ) };
+		const int64_t spanX{ edge.stepX * ( right - 1 - left ) };
+		const int64_t spanY{ edge.stepY * ( bottom - 1 - top ) };
+		const int64_t maxValue{ cornerValue + std::max( spanX, int64_t{} ) + std::max( spanY, int64_t{} ) };
+		const int64_t minValue{ cornerValue + std::min( spanX, int64_t{} ) + std::min( spanY, int64_t{} ) };
+
+		if ( maxValue < 0 )
+		{
+			return RegionCoverage::none;
+		}
+		isFullyCovered &= minValue >= 0;
+	}
+
+	return isFullyCovered ? RegionCoverage::full : RegionCoverage::partial;
+}
+
+uint32_t GetBlockLaneMask( int blockX, int blockY, int right, int bottom ) noexcept
+{
+	if ( blockX + BLOCK_WIDTH <= right && blockY + BLOCK_HEIGHT <= bottom )
+	{
+		return FULL_BLOCK_MASK;
+	}
+
+	uint32_t laneMask{};
+	for ( int lane{}; lane < BLOCK_SIZE; ++lane )
+	{
+		if ( blockX + ( lane % BLOCK_WIDTH ) < right && blockY + ( lane / BLOCK_WIDTH ) < bottom )
+		{
+			laneMask |= 1u << lane;
+		}
+	}
+	return laneMask;
+}
+
+uint32_t RasterizeBlock( const BlockSetup& blockSetup,
+						 const std::array<int64_t, 3>& edgeValues,
+						 float* pDepth,
+						 int depthPitch,
+						 uint32_t laneMask,
+						 bool testEdges,
+						 DepthMode depthMode,
+						 BlockOutput& output ) noexcept
+{
+	const float baseWeight0{ static_cast<float>( edgeValues[0] ) * blockSetup.inverseDoubleArea };
+	const float baseWeight1{ static_cast<float>( edgeValues[1] ) * blockSetup.inverseDoubleArea };
+
+#if defined( SIMD_AVX2 )
+	// Coverage, a lane is inside when none of its edge values has the sign bit set
+	uint32_t mask{ laneMask };
+	if ( testEdges )
+	{
+		__m256i signs{ _mm256_setzero_si256() };
+		for ( size_t edgeIndex{}; edgeIndex < edgeValues.size(); ++edgeIndex )
+		{
+			const __m256i offsets{ _mm256_load_si256(
+				reinterpret_cast<const __m256i*>( blockSetup.edgeOffsets[edgeIndex].data() ) ) };
+			signs = _mm256_or_si256(
+				signs, _mm256_add_epi32( _mm256_set1_epi32( ClampEdgeValue( edgeValues[edgeIndex] ) ), offsets ) );
+		}
+		mask &= ~static_cast<uint32_t>( _mm256_movemask_ps( _mm256_castsi256_ps( signs ) ) );
+		if ( !mask )
+		{
+			return 0;
+		}
+	}
+
+	// Barycentric weights, the last one derived so they always sum up to one
+	const __m256 one{ _mm256_set1_ps( 1.f ) };
+	const __m256 weight0{ _mm256_add_ps( _mm256_set1_ps( baseWeight0 ),
+										 _mm256_load_ps( blockSetup.weightOffsets[0].data() ) ) };
+	const __m256 weight1{ _mm256_add_ps( _mm256_set1_ps( baseWeight1 ),
+										 _mm256_load_ps( blockSetup.weightOffsets[1].data() ) ) };
+	const __m256 weight2{ _mm256_sub_ps( _mm256_sub_ps( one, weight0 ), weight1 ) };
+
+	// Depth after the perspective divide is linear in screen space
+	const __m256 depths{ _mm256_fmadd_ps(
+		weight2,
+		_mm256_set1_ps( blockSetup.depths[2] ),
+		_mm256_fmadd_ps(
+			weight1, _mm256_set1_ps( blockSetup.depths[1] ), _mm256_mul_ps( weight0, _mm256_set1_ps( blockSetup.depths[0] ) ) ) ) };
+
+	// Depth test
+	__m256 oldDepths{};
+	if ( laneMask == FULL_BLOCK_MASK )
+	{
+		oldDepths = _mm256_insertf128_ps(
+			_mm256_castps128_ps256( _mm_loadu_ps( pDepth ) ), _mm_loadu_ps( pDepth + depthPitch ), 1 );
+	}
+	else
+	{
+		alignas( 32 ) std::array<float, BLOCK_SIZE> gatheredDepths{};
+		GatherDepths( pDepth, depthPitch, laneMask, gatheredDepths.data() );
+		oldDepths = _mm256_load_ps( gatheredDepths.data() );
+	}
+	const __m256 passed{ depthMode == DepthMode::testEqual ? _mm256_cmp_ps( depths, oldDepths, _CMP_EQ_OQ )
+														   : _mm256_cmp_ps( depths, oldDepths, _CMP_NGT_UQ ) };
+	mask &= static_cast<uint32_t>( _mm256_movemask_ps( passed ) );
+	if ( !mask )
+	{
+		return 0;
+	}
+
+	if ( depthMode == DepthMode::testEqual )
+	{
+		_mm256_store_ps( output.depths.data(), depths );
+	}
+	else if ( laneMask == FULL_BLOCK_MASK )
+	{
+		const __m256i laneBits{ _mm256_setr_epi32( 1, 2, 4, 8, 16, 32, 64, 128 ) };
+		const __m256 writeMask{ _mm256_castsi256_ps(
+			_mm256_cmpeq_epi32( _mm256_and_si256( _mm256_set1_epi32( static_cast<int>( mask ) ), laneBits ), laneBits ) ) };
+		const __m256 newDepths{ _mm256_blendv_ps( oldDepths, depths, writeMask ) };
+		_mm_storeu_ps( pDepth, _mm256_castps256_ps128( newDepths ) );
+		_mm_storeu_ps( pDepth + depthPitch, _mm256_extractf128_ps( newDepths, 1 ) );
+		_mm256_store_ps( output.depths.data(), depths );
+	}
+	else
+	{
+		_mm256_store_ps( output.depths.data(), depths );
+		ScatterDepths( output.depths.data(), mask, pDepth, depthPitch );
+	}
+
+	// Perspective correct view depth
+	const __m256 inverseViewDepth{ _mm256_fmadd_ps(
+		weight2,
+		_mm256_set1_ps( blockSetup.inverseViewDepths[2] ),
+		_mm256_fmadd_ps( weight1,
+						 _mm256_set1_ps( blockSetup.inverseViewDepths[1] ),
+						 _mm256_mul_ps( weight0, _mm256_set1_ps( blockSetup.inverseViewDepths[0] ) ) ) ) };
+	_mm256_store_ps( output.viewDepths.data(), _mm256_div_ps( one, inverseViewDepth ) );
+
+	return mask;
+#elif defined( SIMD_SSE )
+	// Coverage, a lane is inside when none of its edge values has the sign bit set
+	uint32_t mask{ laneMask };
+	if ( testEdges )
+	{
+		__m128i signs{ _mm_setzero_si128() };
+		for ( size_t edgeIndex{}; edgeIndex < edgeValues.size(); ++edgeIndex )
+		{
+			const __m128i offsets{ _mm_load_si128(
+				reinterpret_cast<const __m128i*>( blockSetup.edgeOffsets[edgeIndex].data() ) ) };
+			signs = _mm_or_si128( signs,
+								  _mm_add_epi32( _mm_set1_epi32( ClampEdgeValue( edgeValues[edgeIndex] ) ), offsets ) );
+		}
+		mask &= ~static_cast<uint32_t>( _mm_movemask_ps( _mm_castsi128_ps( signs ) ) );
+		if ( !mask )
+		{
+			return 0;
+		}
+	}
+
+	// Barycentric weights, the last one derived so they always sum up to one
+	const __m128 one{ _mm_set1_ps( 1.f ) };
+	const __m128 weight0{ _mm_add_ps( _mm_set1_ps( baseWeight0 ), _mm_load_ps( blockSetup.weightOffsets[0].data() ) ) };
+	const __m128 weight1{ _mm_add_ps( _mm_set1_ps( baseWeight1 ), _mm_load_ps( blockSetup.weightOffsets[1].data() ) ) };
+	const __m128 weight2{ _mm_sub_ps( _mm_sub_ps( one, weight0 ), weight1 ) };
+
+	// Depth after the perspective divide is linear in screen space
+	const __m128 depths{ _mm_add_ps( _mm_add_ps( _mm_mul_ps( weight0, _mm_set1_ps( blockSetup.depths[0] ) ),
+												 _mm_mul_ps( weight1, _mm_set1_ps( blockSetup.depths[1] ) ) ),
+									 _mm_mul_ps( weight2, _mm_set1_ps( blockSetup.depths[2] ) ) ) };
+
+	// Depth test
+	__m128 oldDepths{};
+	if ( laneMask == FULL_BLOCK_MASK )
+	{
+		oldDepths = _mm_movelh_ps( _mm_castpd_ps( _mm_load_sd( reinterpret_cast<const double*>( pDepth ) ) ),
+								   _mm_castpd_ps( _mm_load_sd( reinterpret_cast<const double*>( pDepth + depthPitch ) ) ) );
+	}
+	else
+	{
+		alignas( 16 ) std::array<float, BLOCK_SIZE> gatheredDepths{};
+		GatherDepths( pDepth, depthPitch, laneMask, gatheredDepths.data() );
+		oldDepths = _mm_load_ps( gatheredDepths.data() );
+	}
+	const __m128 passed{ depthMode == DepthMode::testEqual ? _mm_cmpeq_ps( depths, oldDepths )
+														   : _mm_cmpngt_ps( depths, oldDepths ) };
+	mask &= static_cast<uint32_t>( _mm_movemask_ps( passed ) );
+	if ( !mask )
+	{
+		return 0;
+	}
+
+	_mm_store_ps( output.depths.data(), depths );
+	if ( depthMode == DepthMode::testAndWrite )
+	{
+		ScatterDepths( output.depths.data(), mask, pDepth, depthPitch );
+	}
+
+	// Perspective correct view depth
+	const __m128 inverseViewDepth{ _mm_add_ps(
+		_mm_add_ps( _mm_mul_ps( weight0, _mm_set1_ps( blockSetup.inverseViewDepths[0] ) ),
+					_mm_mul_ps( weight1, _mm_set1_ps( blockSetup.inverseViewDepths[1] ) ) ),
+		_mm_mul_ps( weight2, _mm_set1_ps( blockSetup.inverseViewDepths[2] ) ) ) };
+	_mm_store_ps( output.viewDepths.data(), _mm_div_ps( one, inverseViewDepth ) );
+
+	return mask;
+#else
+	uint32_t mask{};
+	for ( int lane{}; lane < BLOCK_SIZE; ++lane )
+	{
+		if ( !( laneMask & ( 1u << lane ) ) )
+		{
+			continue;
+		}
+
+		// Coverage
+		bool isInside{ true };
+		for ( size_t edgeIndex{}; testEdges && edgeIndex < edgeValues.size(); ++edgeIndex )
+		{
+			isInside &= edgeValues[edgeIndex] + blockSetup.edgeOffsets[edgeIndex][lane] >= 0;
+		}
+		if ( !isInside )
+		{
+			continue;
+		}
+
+		// Barycentric weights, the last one derived so they always sum up to one
+		const float weight0{ baseWeight0 + blockSetup.weightOffsets[0][lane] };
+		const float weight1{ baseWeight1 + blockSetup.weightOffsets[1][lane] };
+		const float weight2{ 1.f - weight0 - weight1 };
+
+		// Depth after the perspective divide is linear in screen space
+		const float depth{ weight0 * blockSetup.depths[0] + weight1 * blockSetup.depths[1] +
+						   weight2 * blockSetup.depths[2] };
+
+		// Depth test
+		float& oldDepth{ pDepth[GetLaneOffset( lane, depthPitch )] };
+		if ( depthMode == DepthMode::testEqual ? depth != oldDepth : depth > oldDepth )
+		{
+			continue;
+		}
+		if ( depthMode == DepthMode::testAndWrite )
+		{
+			oldDepth = depth;
+		}
+		mask |= 1u << lane;
+
+		// Perspective correct view depth
+		output.viewDepths[lane] =
+			1.f / ( weight0 * blockSetup.inverseViewDepths[0] + weight1 * blockSetup.inverseViewDepths[1] +
+					weight2 * blockSetup.inverseViewDepths[2] );
+		output.depths[lane] = depth;
+	}
+
+	return mask;
+#endif
+}
+} // namespace dae
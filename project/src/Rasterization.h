@@ -0,0 +1,155 @@
+#ifndef RASTERIZATION_H
+#define RASTERIZATION_H
+
+#include <array>
+#include <cstdint>
+#include "DataTypes.h"
+
+// Everything related to turning projected triangles into covered pixels
+
+// DISABLE_SIMD comes from the build, see the option in CMakeLists.txt
+
+#if !defined( DISABLE_SIMD ) && defined( __AVX2__ )
+#	define SIMD_AVX2
+#elif !defined( DISABLE_SIMD ) && ( defined( __SSE2__ ) || defined( _M_X64 ) )
+#	define SIMD_SSE
+#endif
+
+namespace dae
+{
+// Screen positions get snapped to a grid with this many bits below the pixel
+constexpr int SUBPIXEL_BITS{ 4 };
+constexpr int SUBPIXEL_SCALE{ 1 << SUBPIXEL_BITS };
+
+// Pixels are evaluated in blocks aligned to the block grid, so every 2x2 quad lies within a single block
+#ifdef SIMD_AVX2
+constexpr int BLOCK_WIDTH{ 4 };
+#else
+constexpr int BLOCK_WIDTH{ 2 };
+#endif
+constexpr int BLOCK_HEIGHT{ 2 };
+constexpr int BLOCK_SIZE{ BLOCK_WIDTH * BLOCK_HEIGHT };
+constexpr uint32_t FULL_BLOCK_MASK{ ( 1u << BLOCK_SIZE ) - 1 };
+
+// Blocks get grouped into square coarse blocks that are accepted or rejected as a whole
+constexpr int COARSE_BLOCK_SIZE{ 8 };
+
+enum class RegionCoverage
+{
+	none,
+	partial,
+	full,
+};
+
+// How the block kernel treats the depth buffer
+enum class DepthMode
+{
+	testAndWrite, // Pass when not farther than the stored depth and store it
+	testEqual,	  // Pass only at exactly the stored depth and leave it untouched
+};
+
+struct EdgeFunction
+{
+	int64_t stepX{};  // Change when moving one pixel to the right
+	int64_t stepY{};  // Change when moving one pixel down
+	int64_t origin{}; // Value at the center of pixel (0, 0), fill rule bias included
+
+	int64_t Evaluate( int px, int py ) const noexcept
+	{
+		return origin + stepX * px + stepY * py;
+	}
+};
+
+struct TriangleSetup
+{
+	// edges[i] is the edge opposite of vertex i, so its value over the doubled area is the weight of vertex i
+	std::array<EdgeFunction, 3> edges{};
+	float inverseDoubleArea{};
+
+	// Depth is linear over the triangle, so these are the extremes of its vertices
+	float minDepth{};
+	float maxDepth{};
+
+	// Pixel bounds, right and bottom are exclusive
+	int left{};
+	int right{};
+	int top{};
+	int bottom{};
+};
+
+// Value of an attribute over the screen, relative to the first vertex of its triangle
+struct AttributePlane
+{
+	float value{};
+	float stepX{}; // Change when moving one pixel to the right
+	float stepY{}; // Change when moving one pixel down
+
+	float Evaluate( float offsetX, float offsetY ) const noexcept
+	{
+		return value + stepX * offsetX + stepY * offsetY;
+	}
+};
+
+// Everything that gets interpolated over a triangle, set up once so each pixel only needs two multiply-adds per float
+struct AttributePlanes
+{
+	// Screen position the planes are relative to
+	float originX{};
+	float originY{};
+
+	// View space directions, interpolated linearly in screen space
+	std::array<AttributePlane, 3> normal{};
+	std::array<AttributePlane, 3> tangent{};
+
+	// Divided by the view depth, multiplying by the interpolated view depth makes them perspective correct
+	std::array<AttributePlane, 2> uvOverW{};
+
+	// Constant over the triangle
+	uint16_t meshId{};
+};
+
+// Per triangle constants of the block kernel
+struct BlockSetup
+{
+	// Offset of every pixel in the block from the edge values at the block origin
+	alignas( 32 ) std::array<std::array<int32_t, BLOCK_SIZE>, 3> edgeOffsets{};
+	alignas( 32 ) std::array<std::array<float, BLOCK_SIZE>, 2> weightOffsets{};
+
+	std::array<float, 3> depths{};
+	std::array<float, 3> inverseViewDepths{};
+	float inverseDoubleArea{};
+};
+
+// Per pixel results of the block kernel, lane x + y * BLOCK_WIDTH holds pixel (x, y) of the block
+struct BlockOutput
+{
+	alignas( 32 ) std::array<float, BLOCK_SIZE> depths{};
+	alignas( 32 ) std::array<float, BLOCK_SIZE> viewDepths{};
+};
+
+// Returns false when the triangle can never cover a pixel (degenerate or facing away)
+bool SetupTriangle( const TriangleOut& triangle, TriangleSetup& setup ) noexcept;
+BlockSetup SetupBlock( const TriangleSetup& setup, const TriangleOut& triangle ) noexcept;
+AttributePlanes SetupAttributePlanes( const TriangleOut& triangle ) noexcept;
+
+// How much of the pixels in [left, right) x [top, bottom) the triangle covers, from the edge values at its corners
+RegionCoverage GetRegionCoverage( const TriangleSetup& setup, int left, int top, int right, int bottom ) noexcept;
+
+// Lanes of the block starting at (blockX, blockY) that lie before the exclusive right and bottom bounds
+uint32_t GetBlockLaneMask( int blockX, int blockY, int right, int bottom ) noexcept;
+
+// Tests coverage and depth for a whole block and writes the depth of the pixels that pass
+// pDepth points to the depth of the block origin, edgeValues hold the edge values at that origin
+// Blocks known to be fully covered can skip the edge tests
+// Returns a mask with a bit set for every lane that passed
+uint32_t RasterizeBlock( const BlockSetup& blockSetup,
+						 const std::array<int64_t, 3>& edgeValues,
+						 float* pDepth,
+						 int depthPitch,
+						 uint32_t laneMask,
+						 bool testEdges,
+						 DepthMode depthMode,
+						 BlockOutput& output ) noexcept;
+} // namespace dae
+
+#endif
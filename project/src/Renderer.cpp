@@ -1,6 +1,11 @@
 // External includes
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <cstdint>
 #include <execution>
+#include <numeric>
+#include <thread>
 #include <SDL_keyboard.h>
 
 // Project includes
@@ -8,6 +13,9 @@
 #include "Scene.h"
 
 #define PARALLEL_PROJECT
+#define PARALLEL_RASTER
+#define PARALLEL_RESOLVE
+#define PARALLEL_LIGHT_BINNING
 
 using namespace dae;
 
@@ -19,15 +27,44 @@ Renderer::Renderer( SDL_Window* pWindow )
 
 	// Create Buffers
 	m_pFrontBuffer = SDL_GetWindowSurface( pWindow );
-	m_pBackBuffer = SDL_CreateRGBSurface( 0, m_Width, m_Height, 32, 0, 0, 0, 0 );
+	// The pixels of a back buffer start on a cache line, which the resolve bands rely on
+	auto createBackBuffer{ []( int width, int height ) {
+		void* pPixels{ ::operator new( sizeof( uint32_t ) * width * height, m_BackBufferAlignment ) };
+		return SDL_CreateRGBSurfaceFrom(
+			pPixels, width, height, 32, width * static_cast<int>( sizeof( uint32_t ) ), 0, 0, 0, 0 );
+	} };
+	m_pBackBuffer = createBackBuffer( m_Width, m_Height );
+	m_pReducedBackBuffer =
+		createBackBuffer( m_Width / m_ReducedResolutionDivisor, m_Height / m_ReducedResolutionDivisor );
 	m_pBackBufferPixels = reinterpret_cast<uint32_t*>( m_pBackBuffer->pixels );
+	m_pPresentedBuffer = m_pBackBuffer;
 	m_DepthBufferPixels = std::vector<float>( m_Width * m_Height );
-	m_PixelAttributeBuffer = std::vector<std::pair<bool, VertexOut>>( m_Width * m_Height );
+	m_GBuffer.Resize( m_Width * m_Height );
+	m_VisibilityBuffer = std::vector<uint32_t>( m_Width * m_Height );
+
+	// Split screen into tiles, enough for the whole window so changing resolution never allocates
+	const int windowTileCountX{ ( m_Width + m_TileSize - 1 ) / m_TileSize };
+	const int windowTileCountY{ ( m_Height + m_TileSize - 1 ) / m_TileSize };
+	m_Tiles = std::vector<Tile>( windowTileCountX * windowTileCountY );
+	for ( Tile& tile : m_Tiles )
+	{
+		tile.coarseMaxDepths = std::vector<float>( m_TileCoarseBlocks * m_TileCoarseBlocks );
+	}
+	m_TileLightIndices.resize( m_Tiles.size() );
+	LayoutTiles();
+
+	SetResolveThreadCount( 0 );
 }
 
 Renderer::~Renderer()
 {
-	SDL_FreeSurface( m_pBackBuffer );
+	// The surfaces do not own their pixels
+	for ( SDL_Surface* pBackBuffer : { m_pBackBuffer, m_pReducedBackBuffer } )
+	{
+		void* pPixels{ pBackBuffer->pixels };
+		SDL_FreeSurface( pBackBuffer );
+		::operator delete( pPixels, m_BackBufferAlignment );
+	}
 }
 
 void Renderer::Update( Timer* pTimer )
@@ -38,6 +75,7 @@ void Renderer::Update( Timer* pTimer )
 	{
 		m_F4Held = true;
 		m_ShowDepthBuffer = !m_ShowDepthBuffer;
+		++m_SettingsVersion;
 	}
 	if ( !pKeyboardState[SDL_SCANCODE_F4] )
 	{
@@ -48,17 +86,52 @@ void Renderer::Update( Timer* pTimer )
 	{
 		m_F6Held = true;
 		m_UseNormalMap = !m_UseNormalMap;
+		++m_SettingsVersion;
 	}
 	if ( !pKeyboardState[SDL_SCANCODE_F6] )
 	{
 		m_F6Held = false;
 	}
 
+	if ( pKeyboardState[SDL_SCANCODE_F8] && !m_F8Held )
+	{
+		m_F8Held = true;
+		m_UseDepthPrepass = !m_UseDepthPrepass;
+		++m_SettingsVersion;
+	}
+	if ( !pKeyboardState[SDL_SCANCODE_F8] )
+	{
+		m_F8Held = false;
+	}
+
+	if ( pKeyboardState[SDL_SCANCODE_F9] && !m_F9Held )
+	{
+		m_F9Held = true;
+		m_UseVisibilityBuffer = !m_UseVisibilityBuffer;
+		++m_SettingsVersion;
+	}
+	if ( !pKeyboardState[SDL_SCANCODE_F9] )
+	{
+		m_F9Held = false;
+	}
+
+	if ( pKeyboardState[SDL_SCANCODE_F11] && !m_F11Held )
+	{
+		m_F11Held = true;
+		m_UseFastShadingMath = !m_UseFastShadingMath;
+		++m_SettingsVersion;
+	}
+	if ( !pKeyboardState[SDL_SCANCODE_F11] )
+	{
+		m_F11Held = false;
+	}
+
 	if ( !m_F7Held && pKeyboardState[SDL_SCANCODE_F7] )
 	{
 		m_LightingMode = static_cast<LightingMode>( ( static_cast<int>( m_LightingMode ) + 1 ) %
 													static_cast<int>( LightingMode::count ) );
 		m_F7Held = true;
+		++m_SettingsVersion;
 	}
 	else if ( m_F7Held && !pKeyboardState[SDL_SCANCODE_F7] )
 	{
@@ -66,11 +139,48 @@ void Renderer::Update( Timer* pTimer )
 	}
 }
 
+void Renderer::SetReducedResolution( bool isReduced ) noexcept
+{
+	if ( isReduced == m_IsReducedResolution )
+	{
+		return;
+	}
+	m_IsReducedResolution = isReduced;
+
+	SDL_Surface* pBackBuffer{ isReduced ? m_pReducedBackBuffer : m_pBackBuffer };
+	m_Width = pBackBuffer->w;
+	m_Height = pBackBuffer->h;
+	m_pBackBufferPixels = reinterpret_cast<uint32_t*>( pBackBuffer->pixels );
+	LayoutTiles();
+
+	// The projection depends on the resolution
+	for ( MeshGeometry& geometry : m_MeshGeometries )
+	{
+		geometry.isValid = false;
+	}
+}
+
+uint32_t Renderer::GetSettingsVersion() const noexcept
+{
+	return m_SettingsVersion;
+}
+
+void Renderer::SetResolveThreadCount( uint32_t threadCount )
+{
+	if ( threadCount == 0 )
+	{
+		threadCount = std::max( std::thread::hardware_concurrency(), 1u );
+	}
+	m_ResolveWorkers.resize( threadCount );
+	std::iota( m_ResolveWorkers.begin(), m_ResolveWorkers.end(), 0u );
+}
+
 void Renderer::Render( const Scene* pScene )
 {
 	//@START
 	// Lock BackBuffer
-	SDL_LockSurface( m_pBackBuffer );
+	SDL_Surface* pBackBuffer{ m_IsReducedResolution ? m_pReducedBackBuffer : m_pBackBuffer };
+	SDL_LockSurface( pBackBuffer );
 
 	// Flush buffers
 	for ( int px{}; px < m_Width; ++px )
@@ -84,411 +194,1020 @@ void Renderer::Render( const Scene* pScene )
 	{
 		depthPixel = std::numeric_limits<float>::max();
 	}
+	if ( m_UseVisibilityBuffer )
+	{
+		std::fill( m_VisibilityBuffer.begin(), m_VisibilityBuffer.end(), NO_TRIANGLE );
+	}
+	else
+	{
+		m_GBuffer.Clear();
+	}
+	for ( auto& tile : GetTiles() )
+	{
+		std::fill( tile.coarseMaxDepths.begin(), tile.coarseMaxDepths.end(), std::numeric_limits<float>::max() );
+		tile.maxDepth = std::numeric_limits<float>::max();
+		tile.staleCoarseBlocks = 0;
+	}
 
 	// Get world to camera
 	Matrix worldToCamera{ Matrix::Inverse( pScene->GetCamera().GetCameraToWorld() ) };
+	const FrustumPlanes frustumPlanes{ pScene->GetCamera().GetFrustumPlanes( static_cast<float>( m_Width ) /
+																			 m_Height ) };
 
 	// For every mesh
 	const auto& meshes{ pScene->GetMeshes() };
-	for ( const auto& mesh : meshes )
+	if ( m_MeshGeometries.size() != meshes.size() )
 	{
-		RasterizeMesh( mesh, pScene, worldToCamera );
+		m_MeshGeometries.resize( meshes.size() );
+		for ( size_t meshIndex{}; meshIndex < meshes.size(); ++meshIndex )
+		{
+			ReserveGeometry( meshes[meshIndex], m_MeshGeometries[meshIndex] );
+		}
 	}
+	assert( meshes.size() < GBuffer::NO_MESH && "Too many meshes to identify in the G-buffer" );
+	assert( meshes.size() < MAX_VISIBILITY_MESHES && "Too many meshes to identify in the visibility buffer" );
+	auto rasterizeMeshes{ [&]( RasterPass pass ) {
+		for ( size_t meshIndex{}; meshIndex < meshes.size(); ++meshIndex )
+		{
+			// Meshes off the screen are skipped before any of their vertices get touched
+			const Mesh& mesh{ meshes[meshIndex] };
+			const Containment containment{ ClassifyBounds( mesh.bounds, mesh.worldMatrix * worldToCamera, frustumPlanes ) };
+			if ( containment == Containment::outside )
+			{
+				continue;
+			}
+			RasterizeMesh( mesh,
+						   static_cast<uint16_t>( meshIndex ),
+						   pScene,
+						   worldToCamera,
+						   pass,
+						   containment == Containment::inside );
+		}
+	} };
+
+	if ( m_UseVisibilityBuffer )
+	{
+		// Already interpolates only the visible fragments, a prepass has nothing left to save
+		rasterizeMeshes( RasterPass::visibility );
+	}
+	else if ( m_UseDepthPrepass )
+	{
+		// Settle the depth of every pixel first, so only the visible fragments get interpolated
+		rasterizeMeshes( RasterPass::depthOnly );
+		rasterizeMeshes( RasterPass::equalDepth );
+	}
+	else
+	{
+		rasterizeMeshes( RasterPass::depthAndAttributes );
+	}
+
+	// Shade every pixel once, whichever mesh it ended up with
+	Resolve( pScene );
 
 	//@END
 	// Update SDL Surface
-	SDL_UnlockSurface( m_pBackBuffer );
-	SDL_BlitSurface( m_pBackBuffer, 0, m_pFrontBuffer, 0 );
+	SDL_UnlockSurface( pBackBuffer );
+	if ( m_IsReducedResolution )
+	{
+		SDL_BlitScaled( pBackBuffer, nullptr, m_pFrontBuffer, nullptr );
+	}
+	else
+	{
+		SDL_BlitSurface( pBackBuffer, nullptr, m_pFrontBuffer, nullptr );
+	}
 	SDL_UpdateWindowSurface( m_pWindow );
+	m_pPresentedBuffer = pBackBuffer;
+}
+
+void Renderer::LayoutTiles() noexcept
+{
+	m_TileCountX = ( m_Width + m_TileSize - 1 ) / m_TileSize;
+	m_TileCountY = ( m_Height + m_TileSize - 1 ) / m_TileSize;
+	assert( static_cast<size_t>( m_TileCountX * m_TileCountY ) <= m_Tiles.size() && "More tiles than the window has" );
+	for ( int tileY{}; tileY < m_TileCountY; ++tileY )
+	{
+		for ( int tileX{}; tileX < m_TileCountX; ++tileX )
+		{
+			Tile& tile{ m_Tiles[tileX + ( tileY * m_TileCountX )] };
+			tile.left = tileX * m_TileSize;
+			tile.top = tileY * m_TileSize;
+			tile.right = std::min( tile.left + m_TileSize, m_Width );
+			tile.bottom = std::min( tile.top + m_TileSize, m_Height );
+		}
+	}
+}
+
+std::span<Tile> Renderer::GetTiles() noexcept
+{
+	return { m_Tiles.data(), static_cast<size_t>( m_TileCountX * m_TileCountY ) };
 }
 
-void Renderer::RasterizeMesh( const Mesh& mesh, const Scene* pScene, const Matrix& worldToCamera ) noexcept
+void Renderer::RasterizeMesh( const Mesh& mesh,
+							  uint16_t meshId,
+							  const Scene* pScene,
+							  const Matrix& worldToCamera,
+							  RasterPass pass,
+							  bool isInsideFrustum ) noexcept
 {
+	MeshGeometry& geometry{ m_MeshGeometries[meshId] };
 	const Camera& camera{ pScene->GetCamera() };
 
-	// Flush pixel attribute buffer
-	for ( auto& pixel : m_PixelAttributeBuffer )
+	// Nothing moved since the geometry was built, so projecting and assembling again would give the same triangles
+	const bool needsAttributePlanes{ pass == RasterPass::depthAndAttributes || pass == RasterPass::equalDepth };
+	const bool needsTriangleIds{ pass == RasterPass::visibility };
+	const bool isUpToDate{ geometry.isValid && geometry.cameraVersion == camera.GetVersion() &&
+						   geometry.transformVersion == mesh.transformVersion &&
+						   ( !needsAttributePlanes || geometry.hasAttributePlanes ) &&
+						   ( !needsTriangleIds || geometry.hasTriangleIds ) };
+	if ( !isUpToDate )
 	{
-		pixel = {};
+		AssembleMesh( mesh, meshId, camera, worldToCamera, pass, isInsideFrustum, geometry );
 	}
 
-	// PROJECTION
-	std::vector<VertexOut> verticesOut{};
-	Project( mesh.vertices, verticesOut, camera, mesh.worldMatrix, worldToCamera );
+	// BINNING
+	BinTriangles( geometry );
+
+	// RASTERIZATION
+	auto rasterizeTile{ [&]( Tile& tile ) {
+		for ( const uint32_t triangleIndex : tile.triangleIndices )
+		{
+			RasterizeTriangle( geometry.setups[triangleIndex],
+							   geometry.triangles[triangleIndex],
+							   needsAttributePlanes ? &geometry.attributePlanes[triangleIndex] : nullptr,
+							   needsTriangleIds ? geometry.triangleIds[triangleIndex] : NO_TRIANGLE,
+							   tile,
+							   pass );
+		}
+		if ( pass != RasterPass::equalDepth )
+		{
+			UpdateTileDepthBounds( tile );
+		}
+	} };
 
-	// For every triangle in mesh
-	for ( size_t index{}; index < mesh.indices.size(); )
+#ifdef PARALLEL_RASTER
+	const std::span<Tile> tiles{ GetTiles() };
+	std::for_each( std::execution::par, tiles.begin(), tiles.end(), rasterizeTile );
+#endif
+#ifndef PARALLEL_RASTER
+	for ( auto& tile : GetTiles() )
 	{
-		auto goToNextTriangleIndex{ [&]() {
-			// Increment differently based on topology
-			switch ( mesh.primitiveTopology )
+		rasterizeTile( tile );
+	}
+#endif
+
+}
+
+void Renderer::AssembleMesh( const Mesh& mesh,
+							 uint16_t meshId,
+							 const Camera& camera,
+							 const Matrix& worldToCamera,
+							 RasterPass pass,
+							 bool isInsideFrustum,
+							 MeshGeometry& geometry ) noexcept
+{
+	const Projection projection{ camera, m_Width, m_Height };
+
+	// PROJECTION
+	// One matrix for the whole mesh instead of two transforms per vertex
+	const Matrix modelToView{ mesh.worldMatrix * worldToCamera };
+	std::span<const size_t> firstVertices{};
+	if ( mesh.meshlets.empty() )
+	{
+		firstVertices = GetVertexBatches( mesh.GetVertexCount() );
+	}
+	else
+	{
+		// Only the vertices of meshlets that might be visible get projected
+		CullMeshlets( mesh, camera, modelToView, isInsideFrustum );
+		firstVertices = m_MeshletVertexBatches;
+	}
+	std::vector<VertexOut>& verticesOut{ geometry.vertices };
+	Project( mesh, verticesOut, projection, modelToView, firstVertices );
+
+	// TRIANGLE ASSEMBLY
+	geometry.triangles.clear();
+	geometry.setups.clear();
+	geometry.attributePlanes.clear();
+	geometry.triangleIds.clear();
+	const size_t indexCount{ mesh.GetIndexCount() };
+
+	// For every triangle in the range of indices
+	auto assembleIndices{ [&]( size_t firstIndex, size_t endIndex ) {
+		size_t stripStart{ firstIndex };
+		for ( size_t index{ firstIndex }; index < endIndex; )
+		{
+			auto goToNextTriangleIndex{ [&]() {
+				// Increment differently based on topology
+				switch ( mesh.primitiveTopology )
+				{
+				case dae::PrimitiveTopology::TriangleList:
+					index += 3;
+					break;
+
+				case dae::PrimitiveTopology::TriangleStrip:
+					++index;
+					break;
+				}
+			} };
+
+			// Stop if at the end of strip
+			if ( index + 2 >= endIndex )
 			{
-			case dae::PrimitiveTopology::TriangleList:
-				index += 3;
 				break;
-
-			case dae::PrimitiveTopology::TriangleStrip:
+			}
+			const std::array<uint32_t, 3> vertexIndices{ mesh.GetIndex( index + 0 ),
+														 mesh.GetIndex( index + 1 ),
+														 mesh.GetIndex( index + 2 ) };
+
+			// Triangles spanning a restart do not exist, the strip after it starts with even winding again
+			if ( mesh.primitiveTopology == PrimitiveTopology::TriangleStrip &&
+				 ( vertexIndices[0] == RESTART_INDEX || vertexIndices[1] == RESTART_INDEX ||
+				   vertexIndices[2] == RESTART_INDEX ) )
+			{
+				if ( vertexIndices[0] == RESTART_INDEX )
+				{
+					stripStart = index + 1;
+				}
 				++index;
+				continue;
+			}
+
+			// Construct triangle
+			const uint32_t primitiveIndex{ static_cast<uint32_t>(
+				mesh.primitiveTopology == PrimitiveTopology::TriangleList ? index / 3 : index ) };
+			assert( primitiveIndex <= VISIBILITY_PRIMITIVE_MASK && "Too many triangles to identify in the visibility buffer" );
+			TriangleOut projectedTriangle{};
+			switch ( mesh.primitiveTopology )
+			{
+			case PrimitiveTopology::TriangleList:
+				projectedTriangle = TriangleOut{ verticesOut[vertexIndices[0]],
+												 verticesOut[vertexIndices[1]],
+												 verticesOut[vertexIndices[2]] };
+				break;
+			case PrimitiveTopology::TriangleStrip:
+				// Check if mesh is correct size to be a strip
+				assert( indexCount > 6 && "Mesh has too few indices to be a strip" );
+				// Fix orientation for odd triangles
+				if ( ( index - stripStart ) & 1 )
+				{
+					projectedTriangle = TriangleOut{ verticesOut[vertexIndices[0]],
+													 verticesOut[vertexIndices[2]],
+													 verticesOut[vertexIndices[1]] };
+				}
+				else
+				{
+					projectedTriangle = TriangleOut{ verticesOut[vertexIndices[0]],
+													 verticesOut[vertexIndices[1]],
+													 verticesOut[vertexIndices[2]] };
+				}
 				break;
 			}
-		} };
+			projectedTriangle.pTexture = &mesh.texture;
+			projectedTriangle.pNormalMap = &mesh.normalMap;
 
-		// Stop if at the end of strip
-		if ( index + 2 >= mesh.indices.size() )
-		{
-			break;
-		}
-
-		// Construct triangle
-		TriangleOut projectedTriangle{};
-		TriangleWorld worldTriangle{};
-		switch ( mesh.primitiveTopology )
-		{
-		case PrimitiveTopology::TriangleList:
-			projectedTriangle = TriangleOut{ verticesOut[mesh.indices[index + 0]],
-											 verticesOut[mesh.indices[index + 1]],
-											 verticesOut[mesh.indices[index + 2]] };
-			worldTriangle = TriangleWorld{ mesh.transformedVertices[mesh.indices[index + 0]],
-										   mesh.transformedVertices[mesh.indices[index + 1]],
-										   mesh.transformedVertices[mesh.indices[index + 2]] };
-			break;
-		case PrimitiveTopology::TriangleStrip:
-			// Check if mesh is correct size to be a strip
-			assert( mesh.indices.size() > 6 && "Mesh has too few indices to be a strip" );
-			// Fix orientation for odd triangles
-			if ( index & 1 )
+			// Clipping, which a mesh inside the frustum has no need for
+			uint32_t outcodeUnion{};
+			uint32_t outcodeIntersection{};
+			if ( !isInsideFrustum )
 			{
-				projectedTriangle = TriangleOut{ verticesOut[mesh.indices[index + 0]],
-												 verticesOut[mesh.indices[index + 2]],
-												 verticesOut[mesh.indices[index + 1]] };
-				worldTriangle = TriangleWorld{ mesh.transformedVertices[mesh.indices[index + 0]],
-											   mesh.transformedVertices[mesh.indices[index + 2]],
-											   mesh.transformedVertices[mesh.indices[index + 1]] };
+				auto getOutcode{ [&]( const VertexOut& vertex ) {
+					return projection.GetOutcode( projection.ToClipSpace( vertex.viewPosition ) );
+				} };
+				const std::array<uint32_t, 3> outcodes{ getOutcode( projectedTriangle.v0 ),
+														getOutcode( projectedTriangle.v1 ),
+														getOutcode( projectedTriangle.v2 ) };
+				outcodeUnion = outcodes[0] | outcodes[1] | outcodes[2];
+				outcodeIntersection = outcodes[0] & outcodes[1] & outcodes[2];
 			}
-			else
+			if ( !IsCullable( projectedTriangle, outcodeUnion, outcodeIntersection ) )
 			{
-				projectedTriangle = TriangleOut{ verticesOut[mesh.indices[index + 0]],
-												 verticesOut[mesh.indices[index + 1]],
-												 verticesOut[mesh.indices[index + 2]] };
-				worldTriangle = TriangleWorld{ mesh.transformedVertices[mesh.indices[index + 0]],
-											   mesh.transformedVertices[mesh.indices[index + 1]],
-											   mesh.transformedVertices[mesh.indices[index + 2]] };
+				if ( outcodeUnion & CLIP_PLANES )
+				{
+					std::array<TriangleOut, MAX_CLIPPED_TRIANGLES> clippedTriangles{};
+					const int clippedCount{ ClipTriangle( projectedTriangle, projection, outcodeUnion, clippedTriangles ) };
+					for ( int clippedIndex{}; clippedIndex < clippedCount; ++clippedIndex )
+					{
+						AddTriangle( clippedTriangles[clippedIndex], meshId, primitiveIndex, pass, geometry );
+					}
+				}
+				else
+				{
+					AddTriangle( projectedTriangle, meshId, primitiveIndex, pass, geometry );
+				}
 			}
-			break;
+
+			goToNextTriangleIndex();
 		}
-		projectedTriangle.pTexture = &mesh.texture;
-		projectedTriangle.pNormalMap = &mesh.normalMap;
+	} };
 
-		if ( IsCullable( projectedTriangle ) )
+	if ( mesh.meshlets.empty() )
+	{
+		assembleIndices( 0, indexCount );
+	}
+	else
+	{
+		for ( const uint32_t meshletIndex : m_VisibleMeshlets )
 		{
-			goToNextTriangleIndex();
-			continue;
+			const Meshlet& meshlet{ mesh.meshlets[meshletIndex] };
+			assembleIndices( meshlet.firstIndex, meshlet.firstIndex + meshlet.triangleCount * size_t{ 3 } );
 		}
+	}
 
-		const Rectangle projectedTriangleBounds{ projectedTriangle.GetBounds() };
+	geometry.cameraVersion = camera.GetVersion();
+	geometry.transformVersion = mesh.transformVersion;
+	geometry.hasAttributePlanes = pass != RasterPass::visibility;
+	geometry.hasTriangleIds = pass == RasterPass::visibility;
+	geometry.isValid = true;
+}
 
-		auto processPixel{ [&]( int px, int py ) {
-			Vector3 baryCentricPosition{};
-			if ( !IsInPixel( projectedTriangle, px, py, baryCentricPosition ) )
+void Renderer::AddTriangle( const TriangleOut& triangle,
+							uint16_t meshId,
+							uint32_t primitiveIndex,
+							RasterPass pass,
+							MeshGeometry& geometry ) noexcept
+{
+	TriangleSetup triangleSetup{};
+	if ( SetupTriangle( triangle, triangleSetup ) )
+	{
+		geometry.triangles.push_back( triangle );
+		geometry.setups.push_back( triangleSetup );
+		if ( pass == RasterPass::visibility )
+		{
+			geometry.triangleIds.push_back( packing::PackTriangleId( meshId, primitiveIndex ) );
+		}
+		else
+		{
+			// The depth only pass never reads them, but the equal depth pass after it gets to reuse its geometry
+			geometry.attributePlanes.push_back( SetupAttributePlanes( triangle ) );
+			geometry.attributePlanes.back().meshId = meshId;
+		}
+	}
+}
+
+void Renderer::BinTriangles( const MeshGeometry& geometry ) noexcept
+{
+	for ( auto& tile : GetTiles() )
+	{
+		tile.triangleIndices.clear();
+	}
+
+	for ( uint32_t triangleIndex{}; triangleIndex < geometry.setups.size(); ++triangleIndex )
+	{
+		const TriangleSetup& setup{ geometry.setups[triangleIndex] };
+
+		// Every tile the triangle touches gets a reference to it, the parts off screen are scissored away here
+		if ( setup.right <= std::max( setup.left, 0 ) || setup.bottom <= std::max( setup.top, 0 ) ||
+			 setup.left >= m_Width || setup.top >= m_Height )
+		{
+			continue;
+		}
+		const int tileLeft{ std::max( setup.left / m_TileSize, 0 ) };
+		const int tileRight{ std::min( ( setup.right - 1 ) / m_TileSize, m_TileCountX - 1 ) };
+		const int tileTop{ std::max( setup.top / m_TileSize, 0 ) };
+		const int tileBottom{ std::min( ( setup.bottom - 1 ) / m_TileSize, m_TileCountY - 1 ) };
+
+		for ( int tileY{ tileTop }; tileY <= tileBottom; ++tileY )
+		{
+			for ( int tileX{ tileLeft }; tileX <= tileRight; ++tileX )
 			{
-				return;
+				// Hidden behind everything drawn in the tile so far
+				Tile& tile{ m_Tiles[tileX + ( tileY * m_TileCountX )] };
+				if ( setup.minDepth > tile.maxDepth )
+				{
+					continue;
+				}
+
+				// Long diagonal triangles pass through far less tiles than their bounding box does
+				if ( GetRegionCoverage( setup, tile.left, tile.top, tile.right, tile.bottom ) != RegionCoverage::none )
+				{
+					tile.triangleIndices.push_back( triangleIndex );
+				}
 			}
+		}
+	}
+}
 
-			const float interpolatedDepth{ 1.f /
-										   ( ( 1.f / projectedTriangle.v0.position.z ) * baryCentricPosition.x +
-											 ( 1.f / projectedTriangle.v1.position.z ) * baryCentricPosition.y +
-											 ( 1.f / projectedTriangle.v2.position.z ) * baryCentricPosition.z ) };
+void Renderer::RasterizeTriangle( const TriangleSetup& setup,
+								  const TriangleOut& triangle,
+								  const AttributePlanes* pPlanes,
+								  uint32_t triangleId,
+								  Tile& tile,
+								  RasterPass pass ) noexcept
+{
+	const DepthMode depthMode{ pass == RasterPass::equalDepth ? DepthMode::testEqual : DepthMode::testAndWrite };
 
-			const int bufferIndex{ px + ( py * m_Width ) };
+	// Only visit the part of the bounding box that lies inside of the tile, snapped outwards to whole blocks
+	const int coarseBlocksLeft{ std::max( setup.left, tile.left ) & ~( COARSE_BLOCK_SIZE - 1 ) };
+	const int coarseBlocksRight{ std::min( setup.right, tile.right ) };
+	const int coarseBlocksTop{ std::max( setup.top, tile.top ) & ~( COARSE_BLOCK_SIZE - 1 ) };
+	const int coarseBlocksBottom{ std::min( setup.bottom, tile.bottom ) };
 
-			// Check Depth Buffer
-			if ( interpolatedDepth > m_DepthBufferPixels[bufferIndex] )
+	const BlockSetup blockSetup{ SetupBlock( setup, triangle ) };
+	BlockOutput blockOutput{};
+
+	for ( int coarseBlockY{ coarseBlocksTop }; coarseBlockY < coarseBlocksBottom; coarseBlockY += COARSE_BLOCK_SIZE )
+	{
+		for ( int coarseBlockX{ coarseBlocksLeft }; coarseBlockX < coarseBlocksRight;
+			  coarseBlockX += COARSE_BLOCK_SIZE )
+		{
+			const int coarseBlockRight{ std::min( coarseBlockX + COARSE_BLOCK_SIZE, tile.right ) };
+			const int coarseBlockBottom{ std::min( coarseBlockY + COARSE_BLOCK_SIZE, tile.bottom ) };
+
+			// Hidden behind everything drawn in the block so far
+			const int coarseBlockIndex{ ( coarseBlockX - tile.left ) / COARSE_BLOCK_SIZE +
+										( ( coarseBlockY - tile.top ) / COARSE_BLOCK_SIZE ) * m_TileCoarseBlocks };
+			float& coarseMaxDepth{ tile.coarseMaxDepths[coarseBlockIndex] };
+			if ( setup.minDepth > coarseMaxDepth )
 			{
-				return;
+				continue;
 			}
-			m_DepthBufferPixels[bufferIndex] = interpolatedDepth;
 
-			const float viewSpaceDepthInterpolated{
-				1.f / ( ( 1.f / projectedTriangle.v0.position.w ) * baryCentricPosition.x +
-						( 1.f / projectedTriangle.v1.position.w ) * baryCentricPosition.y +
-						( 1.f / projectedTriangle.v2.position.w ) * baryCentricPosition.z )
+			// Skip the whole block when it lies outside of an edge, drop the edge tests when it lies inside all
+			const RegionCoverage coverage{
+				GetRegionCoverage( setup, coarseBlockX, coarseBlockY, coarseBlockRight, coarseBlockBottom )
 			};
+			if ( coverage == RegionCoverage::none )
+			{
+				continue;
+			}
+			const bool isFullyCovered{ coverage == RegionCoverage::full };
+			uint32_t coarseWrittenMask{};
 
-			Vector4 interpolatedPosition{};
-			Vector3 interpolatedNormal{};
-			Vector3 interpolatedTangent{};
-
-			// Interpolate
-			interpolatedPosition.x = worldTriangle.v0.position.x * baryCentricPosition.x +
-									 worldTriangle.v1.position.x * baryCentricPosition.y +
-									 worldTriangle.v2.position.x * baryCentricPosition.z;
-			interpolatedPosition.y = worldTriangle.v0.position.y * baryCentricPosition.x +
-									 worldTriangle.v1.position.y * baryCentricPosition.y +
-									 worldTriangle.v2.position.y * baryCentricPosition.z;
-			interpolatedPosition.w = worldTriangle.v0.position.z * baryCentricPosition.x +
-									 worldTriangle.v1.position.z * baryCentricPosition.y +
-									 worldTriangle.v2.position.z * baryCentricPosition.z;
-			interpolatedPosition.z = interpolatedDepth;
-
-			const ColorRGB interpolatedColor{
-				( projectedTriangle.v0.color / projectedTriangle.v0.position.w * baryCentricPosition.x +
-				  projectedTriangle.v1.color / projectedTriangle.v1.position.w * baryCentricPosition.y +
-				  projectedTriangle.v2.color / projectedTriangle.v2.position.w * baryCentricPosition.z ) *
-				viewSpaceDepthInterpolated
-			};
+			// Edge values at the first block of each row, stepped incrementally from there on
+			std::array<int64_t, 3> rowEdgeValues{};
+			for ( size_t edgeIndex{}; edgeIndex < rowEdgeValues.size(); ++edgeIndex )
+			{
+				rowEdgeValues[edgeIndex] = setup.edges[edgeIndex].Evaluate( coarseBlockX, coarseBlockY );
+			}
 
-			const Vector2 interpolatedUV{
-				( projectedTriangle.v0.uv / projectedTriangle.v0.position.w * baryCentricPosition.x +
-				  projectedTriangle.v1.uv / projectedTriangle.v1.position.w * baryCentricPosition.y +
-				  projectedTriangle.v2.uv / projectedTriangle.v2.position.w * baryCentricPosition.z ) *
-				viewSpaceDepthInterpolated
-			};
+			for ( int blockY{ coarseBlockY }; blockY < coarseBlockBottom; blockY += BLOCK_HEIGHT )
+			{
+				std::array<int64_t, 3> edgeValues{ rowEdgeValues };
+				for ( size_t edgeIndex{}; edgeIndex < rowEdgeValues.size(); ++edgeIndex )
+				{
+					rowEdgeValues[edgeIndex] += setup.edges[edgeIndex].stepY * BLOCK_HEIGHT;
+				}
+
+				for ( int blockX{ coarseBlockX }; blockX < coarseBlockRight; blockX += BLOCK_WIDTH )
+				{
+					const std::array<int64_t, 3> blockEdgeValues{ edgeValues };
+					for ( size_t edgeIndex{}; edgeIndex < edgeValues.size(); ++edgeIndex )
+					{
+						edgeValues[edgeIndex] += setup.edges[edgeIndex].stepX * BLOCK_WIDTH;
+					}
+
+					// Coverage, depth test and depth write for the whole block at once
+					const uint32_t laneMask{ GetBlockLaneMask( blockX, blockY, tile.right, tile.bottom ) };
+					const uint32_t passedMask{ RasterizeBlock( blockSetup,
+																blockEdgeValues,
+																&m_DepthBufferPixels[blockX + ( blockY * m_Width )],
+																m_Width,
+																laneMask,
+																!isFullyCovered,
+																depthMode,
+																blockOutput ) };
+
+					if ( pPlanes )
+					{
+						InterpolateBlock( blockX, blockY, passedMask, blockOutput, *pPlanes );
+					}
+					else if ( pass == RasterPass::visibility )
+					{
+						for ( uint32_t remainingMask{ passedMask }; remainingMask; remainingMask &= remainingMask - 1 )
+						{
+							const int lane{ std::countr_zero( remainingMask ) };
+							m_VisibilityBuffer[blockX + ( lane % BLOCK_WIDTH ) + ( blockY + lane / BLOCK_WIDTH ) * m_Width] =
+								triangleId;
+						}
+					}
+					coarseWrittenMask |= passedMask;
+				}
+			}
 
-			interpolatedNormal.x = worldTriangle.v0.normal.x * baryCentricPosition.x +
-								   worldTriangle.v1.normal.x * baryCentricPosition.y +
-								   worldTriangle.v2.normal.x * baryCentricPosition.z;
-			interpolatedNormal.y = worldTriangle.v0.normal.y * baryCentricPosition.x +
-								   worldTriangle.v1.normal.y * baryCentricPosition.y +
-								   worldTriangle.v2.normal.y * baryCentricPosition.z;
-			interpolatedNormal.z = worldTriangle.v0.normal.z * baryCentricPosition.x +
-								   worldTriangle.v1.normal.z * baryCentricPosition.y +
-								   worldTriangle.v2.normal.z * baryCentricPosition.z;
-			interpolatedNormal.Normalize();
-
-			interpolatedTangent.x = worldTriangle.v0.tangent.x * baryCentricPosition.x +
-									worldTriangle.v1.tangent.x * baryCentricPosition.y +
-									worldTriangle.v2.tangent.x * baryCentricPosition.z;
-			interpolatedTangent.y = worldTriangle.v0.tangent.y * baryCentricPosition.x +
-									worldTriangle.v1.tangent.y * baryCentricPosition.y +
-									worldTriangle.v2.tangent.y * baryCentricPosition.z;
-			interpolatedTangent.z = worldTriangle.v0.tangent.z * baryCentricPosition.x +
-									worldTriangle.v1.tangent.z * baryCentricPosition.y +
-									worldTriangle.v2.tangent.z * baryCentricPosition.z;
-			interpolatedTangent.Normalize();
-
-			VertexOut interpolatedVertex{
-				interpolatedPosition, interpolatedColor, interpolatedUV, interpolatedNormal, interpolatedTangent
-			};
+			// Every pixel of a covered block ends up no farther than the triangle, partial writes need a closer look
+			if ( depthMode == DepthMode::testEqual )
+			{
+				continue;
+			}
+			if ( isFullyCovered )
+			{
+				coarseMaxDepth = std::min( coarseMaxDepth, setup.maxDepth );
+			}
+			else if ( coarseWrittenMask )
+			{
+				tile.staleCoarseBlocks |= uint64_t{ 1 } << coarseBlockIndex;
+			}
+		}
+	}
+}
 
-			m_PixelAttributeBuffer[bufferIndex].first = true;
-			m_PixelAttributeBuffer[bufferIndex].second = interpolatedVertex;
-		} };
+void Renderer::UpdateTileDepthBounds( Tile& tile ) noexcept
+{
+	// Exact bounds for the coarse blocks that were partially written
+	while ( tile.staleCoarseBlocks )
+	{
+		const int coarseBlockIndex{ std::countr_zero( tile.staleCoarseBlocks ) };
+		tile.staleCoarseBlocks &= tile.staleCoarseBlocks - 1;
 
-		const int pixelBoundsLeft{ static_cast<int>( std::floor( projectedTriangleBounds.left ) ) };
-		const int pixelBoundsRight{ static_cast<int>( std::ceil( projectedTriangleBounds.right ) ) };
-		const int pixelBoundsTop{ static_cast<int>( std::floor( projectedTriangleBounds.top ) ) };
-		const int pixelBoundsBottom{ static_cast<int>( std::ceil( projectedTriangleBounds.bottom ) ) };
+		const int left{ tile.left + ( coarseBlockIndex % m_TileCoarseBlocks ) * COARSE_BLOCK_SIZE };
+		const int top{ tile.top + ( coarseBlockIndex / m_TileCoarseBlocks ) * COARSE_BLOCK_SIZE };
+		const int right{ std::min( left + COARSE_BLOCK_SIZE, tile.right ) };
+		const int bottom{ std::min( top + COARSE_BLOCK_SIZE, tile.bottom ) };
 
-		// RASTERIZATION
-		for ( int px{ pixelBoundsLeft }; px < pixelBoundsRight; ++px )
+		float maxDepth{};
+		for ( int py{ top }; py < bottom; ++py )
 		{
-			for ( int py{ pixelBoundsTop }; py < pixelBoundsBottom; ++py )
+			const float* pRow{ &m_DepthBufferPixels[py * m_Width] };
+			for ( int px{ left }; px < right; ++px )
 			{
-				processPixel( px, py );
+				maxDepth = std::max( maxDepth, pRow[px] );
 			}
 		}
+		tile.coarseMaxDepths[coarseBlockIndex] = maxDepth;
+	}
 
-		goToNextTriangleIndex();
+	// Next level up, only the coarse blocks that lie within the screen count
+	const int coarseBlockCountX{ ( tile.right - tile.left + COARSE_BLOCK_SIZE - 1 ) / COARSE_BLOCK_SIZE };
+	const int coarseBlockCountY{ ( tile.bottom - tile.top + COARSE_BLOCK_SIZE - 1 ) / COARSE_BLOCK_SIZE };
+	tile.maxDepth = 0.f;
+	for ( int coarseBlockY{}; coarseBlockY < coarseBlockCountY; ++coarseBlockY )
+	{
+		for ( int coarseBlockX{}; coarseBlockX < coarseBlockCountX; ++coarseBlockX )
+		{
+			tile.maxDepth =
+				std::max( tile.maxDepth, tile.coarseMaxDepths[coarseBlockX + coarseBlockY * m_TileCoarseBlocks] );
+		}
 	}
+}
 
-	for ( int px{}; px < m_Width; ++px )
+void Renderer::InterpolateBlock( int blockX,
+								 int blockY,
+								 uint32_t passedMask,
+								 const BlockOutput& blockOutput,
+								 const AttributePlanes& planes ) noexcept
+{
+	while ( passedMask )
 	{
-		for ( int py{}; py < m_Height; ++py )
+		const int lane{ std::countr_zero( passedMask ) };
+		passedMask &= passedMask - 1;
+
+		const int px{ blockX + ( lane % BLOCK_WIDTH ) };
+		const int py{ blockY + ( lane / BLOCK_WIDTH ) };
+		const int bufferIndex{ px + ( py * m_Width ) };
+
+		// Pixel center relative to the origin of the planes
+		const float offsetX{ static_cast<float>( px ) + 0.5f - planes.originX };
+		const float offsetY{ static_cast<float>( py ) + 0.5f - planes.originY };
+		auto evaluate{ [&]( const AttributePlane& plane ) {
+			return plane.Evaluate( offsetX, offsetY );
+		} };
+
+		const float viewSpaceDepthInterpolated{ blockOutput.viewDepths[lane] };
+
+		// Interpolate
+		const Vector2 interpolatedUV{ evaluate( planes.uvOverW[0] ) * viewSpaceDepthInterpolated,
+									  evaluate( planes.uvOverW[1] ) * viewSpaceDepthInterpolated };
+
+		const Vector3 interpolatedNormal{
+			Vector3{ evaluate( planes.normal[0] ), evaluate( planes.normal[1] ), evaluate( planes.normal[2] ) }.Normalized()
+		};
+
+		const Vector3 interpolatedTangent{
+			Vector3{ evaluate( planes.tangent[0] ), evaluate( planes.tangent[1] ), evaluate( planes.tangent[2] ) }.Normalized()
+		};
+
+		m_GBuffer.meshIds[bufferIndex] = planes.meshId;
+		m_GBuffer.normals[bufferIndex] = packing::PackUnitVector( interpolatedNormal );
+		m_GBuffer.tangents[bufferIndex] = packing::PackUnitVector( interpolatedTangent );
+		m_GBuffer.uvs[bufferIndex] = packing::PackUnorm16x2( packing::WrapTextureCoordinates( interpolatedUV ) );
+	}
+}
+
+void Renderer::Resolve( const Scene* pScene ) noexcept
+{
+	const Camera& camera{ pScene->GetCamera() };
+	const Projection projection{ camera, m_Width, m_Height };
+	const auto& meshes{ pScene->GetMeshes() };
+
+	// Bringing the lights to the pixels is cheaper than bringing every pixel to the lights
+	// The directional ones go first, so the shaders get every type as its own range
+	const Matrix worldToCamera{ Matrix::Inverse( camera.GetCameraToWorld() ) };
+	const std::vector<Light>& lights{ pScene->GetLights() };
+	m_ViewSpaceLights.clear();
+	for ( const Light& light : lights )
+	{
+		if ( light.type == LightType::directional )
+		{
+			m_ViewSpaceLights.push_back( light );
+			m_ViewSpaceLights.back().vector = worldToCamera.TransformVector( light.vector );
+		}
+	}
+	const size_t directionalLightCount{ m_ViewSpaceLights.size() };
+	for ( const Light& light : lights )
+	{
+		if ( light.type == LightType::point )
+		{
+			m_ViewSpaceLights.push_back( light );
+			m_ViewSpaceLights.back().vector = worldToCamera.TransformPoint( light.vector );
+		}
+	}
+	const std::span<const Light> viewSpaceLights{ m_ViewSpaceLights };
+	const ShadingLights shadingLights{ viewSpaceLights.first( directionalLightCount ),
+									   viewSpaceLights.subspan( directionalLightCount ) };
+
+	// Every tile only shades with the point lights that reach it
+	const bool hasTileLights{ !shadingLights.point.empty() };
+	if ( hasTileLights )
+	{
+		BinLights( projection, shadingLights.point );
+	}
+	const auto getLights{ [&]( int px, int py ) {
+		if ( !hasTileLights )
+		{
+			return shadingLights;
+		}
+		const int tileIndex{ px / m_TileSize + ( py / m_TileSize ) * m_TileCountX };
+		return ShadingLights{ shadingLights.directional, shadingLights.point, m_TileLightIndices[tileIndex] };
+	} };
+
+	// Every mesh picks its shaders once, the pixels only look them up
+	m_MeshShaders.resize( meshes.size() );
+	m_MeshBatchShaders.resize( meshes.size() );
+	for ( size_t meshIndex{}; meshIndex < meshes.size(); ++meshIndex )
+	{
+		m_MeshShaders[meshIndex] =
+			GetPixelShader( meshes[meshIndex], shadingLights, m_LightingMode, m_UseNormalMap, m_UseFastShadingMath );
+		m_MeshBatchShaders[meshIndex] =
+			GetBatchShader( meshes[meshIndex], shadingLights, m_LightingMode, m_UseNormalMap, m_UseFastShadingMath );
+	}
+
+	const auto getVisibleTriangle{ [&]( int bufferIndex ) {
+		return m_UseVisibilityBuffer ? m_VisibilityBuffer[bufferIndex] : NO_TRIANGLE;
+	} };
+	const auto getMeshId{ [&]( int bufferIndex ) {
+		if ( !m_UseVisibilityBuffer )
 		{
-			const int bufferIndex{ px + ( py * m_Width ) };
+			return m_GBuffer.meshIds[bufferIndex];
+		}
+		const uint32_t visibleTriangle{ m_VisibilityBuffer[bufferIndex] };
+		return static_cast<uint16_t>( visibleTriangle == NO_TRIANGLE ? GBuffer::NO_MESH
+																	 : visibleTriangle >> VISIBILITY_PRIMITIVE_BITS );
+	} };
+
+	// The position follows from the depth, the rest gets unpacked or interpolated from the visible triangle
+	const auto getPixelVertex{ [&]( int px, int py, uint16_t meshId ) {
+		const int bufferIndex{ px + ( py * m_Width ) };
+		const float depth{ m_DepthBufferPixels[bufferIndex] };
+		const Vector3 viewPosition{
+			projection.ToViewSpace( static_cast<float>( px ) + 0.5f, static_cast<float>( py ) + 0.5f, depth ) };
 
-			if ( !m_PixelAttributeBuffer[bufferIndex].first )
+		VertexOut pixelVertex{};
+		pixelVertex.position = { viewPosition.x, viewPosition.y, depth, viewPosition.z };
+		if ( m_UseVisibilityBuffer )
+		{
+			InterpolateVisibleTriangle( meshes[meshId],
+										m_MeshGeometries[meshId],
+										getVisibleTriangle( bufferIndex ) & VISIBILITY_PRIMITIVE_MASK,
+										viewPosition,
+										pixelVertex );
+		}
+		else
+		{
+			pixelVertex.uv = packing::UnpackUnorm16x2( m_GBuffer.uvs[bufferIndex] );
+			pixelVertex.normal = packing::UnpackUnitVector( m_GBuffer.normals[bufferIndex] );
+			pixelVertex.tangent = packing::UnpackUnitVector( m_GBuffer.tangents[bufferIndex] );
+		}
+		return pixelVertex;
+	} };
+
+	const auto writePixel{ [&]( int bufferIndex, const ColorRGB& finalColor ) {
+		m_pBackBufferPixels[bufferIndex] = SDL_MapRGB( m_pBackBuffer->format,
+													   static_cast<uint8_t>( finalColor.r * 255 ),
+													   static_cast<uint8_t>( finalColor.g * 255 ),
+													   static_cast<uint8_t>( finalColor.b * 255 ) );
+	} };
+
+	const auto resolvePixel{ [&]( int px, int py ) {
+		const int bufferIndex{ px + ( py * m_Width ) };
+		const uint16_t meshId{ getMeshId( bufferIndex ) };
+		if ( meshId == GBuffer::NO_MESH )
+		{
+			return;
+		}
+		if ( m_ShowDepthBuffer )
+		{
+			constexpr float depthMin{ 0.9985f };
+			constexpr float depthMax{ 1.f };
+			const float remappedDepth{ std::max(
+				1.f - ( m_DepthBufferPixels[bufferIndex] - depthMin ) / ( depthMax - depthMin ), 0.f ) };
+			ColorRGB finalColor{ remappedDepth, remappedDepth, remappedDepth };
+
+			finalColor.MaxToOne();
+
+			writePixel( bufferIndex, finalColor );
+			return;
+		}
+
+		// Shaded in view space, where the camera sits at the origin
+		const VertexOut pixelVertex{ getPixelVertex( px, py, meshId ) };
+		writePixel( bufferIndex,
+					m_MeshShaders[meshId]( meshes[meshId], pixelVertex, Vector3{}, getLights( px, py ) ) );
+	} };
+
+	constexpr int batchSize{ static_cast<int>( SHADING_BATCH_SIZE ) };
+	const auto resolveRow{ [&]( int py, PixelBatch& pixels, ColorBatch& colors ) {
+		int px{};
+
+		// Runs of pixels that show the same mesh get shaded together, anything else goes one pixel at a time
+		for ( ; !m_ShowDepthBuffer && px + batchSize <= m_Width; px += batchSize )
+		{
+			const int firstIndex{ px + ( py * m_Width ) };
+			const uint16_t meshId{ getMeshId( firstIndex ) };
+			bool isSameMesh{ meshId != GBuffer::NO_MESH };
+			for ( int lane{ 1 }; isSameMesh && lane < batchSize; ++lane )
 			{
-				continue;
+				isSameMesh = getMeshId( firstIndex + lane ) == meshId;
 			}
-			if ( m_ShowDepthBuffer )
+			if ( !isSameMesh )
 			{
-				constexpr float depthMin{ 0.9985f };
-				constexpr float depthMax{ 1.f };
-				const float remappedDepth{ std::max(
-					1.f - ( m_DepthBufferPixels[bufferIndex] - depthMin ) / ( depthMax - depthMin ), 0.f ) };
-				ColorRGB finalColor{ remappedDepth, remappedDepth, remappedDepth };
+				for ( int lane{}; lane < batchSize; ++lane )
+				{
+					resolvePixel( px + lane, py );
+				}
+				continue;
+			}
 
-				finalColor.MaxToOne();
+			for ( int lane{}; lane < batchSize; ++lane )
+			{
+				const VertexOut pixelVertex{ getPixelVertex( px + lane, py, meshId ) };
+				pixels.positionX[lane] = pixelVertex.position.x;
+				pixels.positionY[lane] = pixelVertex.position.y;
+				pixels.positionZ[lane] = pixelVertex.position.w;
+				pixels.normalX[lane] = pixelVertex.normal.x;
+				pixels.normalY[lane] = pixelVertex.normal.y;
+				pixels.normalZ[lane] = pixelVertex.normal.z;
+				pixels.tangentX[lane] = pixelVertex.tangent.x;
+				pixels.tangentY[lane] = pixelVertex.tangent.y;
+				pixels.tangentZ[lane] = pixelVertex.tangent.z;
+				pixels.u[lane] = pixelVertex.uv.x;
+				pixels.v[lane] = pixelVertex.uv.y;
+			}
 
-				m_pBackBufferPixels[bufferIndex] = SDL_MapRGB( m_pBackBuffer->format,
-															   static_cast<uint8_t>( finalColor.r * 255 ),
-															   static_cast<uint8_t>( finalColor.g * 255 ),
-															   static_cast<uint8_t>( finalColor.b * 255 ) );
+			// A batch never crosses a tile, the tile size is a multiple of the batch size
+			m_MeshBatchShaders[meshId]( meshes[meshId], pixels, getLights( px, py ), colors );
 
-				continue;
+			for ( int lane{}; lane < batchSize; ++lane )
+			{
+				writePixel( firstIndex + lane, { colors.r[lane], colors.g[lane], colors.b[lane] } );
 			}
+		}
 
-			const ColorRGB finalColor{ GetPixelColor( mesh,
-													  m_PixelAttributeBuffer[bufferIndex].second,
-													  camera,
-													  pScene->GetLights(),
-													  m_LightingMode,
-													  m_UseNormalMap ) };
+		for ( ; px < m_Width; ++px )
+		{
+			resolvePixel( px, py );
+		}
+	} };
 
-			m_pBackBufferPixels[bufferIndex] = SDL_MapRGB( m_pBackBuffer->format,
-														   static_cast<uint8_t>( finalColor.r * 255 ),
-														   static_cast<uint8_t>( finalColor.g * 255 ),
-														   static_cast<uint8_t>( finalColor.b * 255 ) );
+	// Bands of rows go to whichever worker is free, so the bands with the most to shade do not hold up the rest
+	// A band is a multiple of a cache line of pixels, so no two workers ever write to the same line
+	assert( reinterpret_cast<std::uintptr_t>( m_pBackBufferPixels ) % m_CacheLineSize == 0 &&
+			"The back buffer does not start on a cache line" );
+	constexpr int pixelsPerCacheLine{ m_CacheLineSize / static_cast<int>( sizeof( uint32_t ) ) };
+	const int rowsPerCacheLine{ pixelsPerCacheLine / std::gcd( m_Width, pixelsPerCacheLine ) };
+	const int bandRows{ ( m_ResolveBandRows + rowsPerCacheLine - 1 ) / rowsPerCacheLine * rowsPerCacheLine };
+	const int bandCount{ ( m_Height + bandRows - 1 ) / bandRows };
+	std::atomic<int> nextBand{};
+
+	const auto resolveBands{ [&]( uint32_t ) {
+		PixelBatch pixels{};
+		ColorBatch colors{};
+		for ( int band{ nextBand++ }; band < bandCount; band = nextBand++ )
+		{
+			const int endRow{ std::min( ( band + 1 ) * bandRows, m_Height ) };
+			for ( int py{ band * bandRows }; py < endRow; ++py )
+			{
+				resolveRow( py, pixels, colors );
+			}
 		}
-	}
+	} };
+
+#ifdef PARALLEL_RESOLVE
+	std::for_each( std::execution::par, m_ResolveWorkers.begin(), m_ResolveWorkers.end(), resolveBands );
+#endif
+#ifndef PARALLEL_RESOLVE
+	resolveBands( 0 );
+#endif
 }
 
-void Renderer::Project( const std::vector<Vertex>& verticesIn,
-						std::vector<VertexOut>& verticesOut,
-						const Camera& camera,
-						const Matrix& modelToWorld,
-						const Matrix& worldToCamera ) const noexcept
+void Renderer::BinLights( const Projection& projection, std::span<const Light> pointLights ) noexcept
 {
-	verticesOut.clear();
-	verticesOut.reserve( verticesIn.size() );
-
-	std::vector<uint32_t> vertexIndices{};
-	vertexIndices.reserve( verticesIn.size() );
-	for ( size_t index{}; index < verticesIn.size(); ++index )
-	{
-		verticesOut.push_back( {} );
-		vertexIndices.push_back( index );
-	}
-
-	auto projectVertex{ [&]( const uint32_t index ) {
-		const Vertex& vertexIn{ verticesIn[index] };
-		VertexOut vertexOut{};
-		vertexOut.uv = vertexIn.uv;
-
-		// World transform
-		vertexOut.position = modelToWorld.TransformPoint( vertexIn.position ).ToPoint4();
-		vertexOut.normal = modelToWorld.TransformVector( vertexIn.normal );
-
-		// Camera transform
-		vertexOut.position = worldToCamera.TransformPoint( vertexOut.position );
-		vertexOut.normal = worldToCamera.TransformVector( vertexOut.normal );
-
-		// Projection matrix
-		const float aspectRatio{ static_cast<float>( m_Width ) / m_Height };
-		const float a{ camera.GetFar() / ( camera.GetFar() - camera.GetNear() ) }; // Depends on coordinate system
-		const float b{ -( camera.GetFar() * camera.GetNear() ) / ( camera.GetFar() - camera.GetNear() ) };
-		Matrix projectionMatrix{
-			{ 1.f / ( aspectRatio * camera.GetFov() ), 0.f, 0.f, 0.f },
-			{ 0.f, 1.f / camera.GetFov(), 0.f, 0.f },
-			{ 0.f, 0.f, a, 1.f },
-			{ 0.f, 0.f, b, 0.f },
-		};
-		vertexOut.position = projectionMatrix.TransformPoint( vertexOut.position );
+	static_assert( m_TileSize % SHADING_BATCH_SIZE == 0, "Shading batches would cross tiles" );
 
-		// Perspective divide
-		vertexOut.position.x /= vertexOut.position.w;
-		vertexOut.position.y /= vertexOut.position.w;
-		vertexOut.position.z /= vertexOut.position.w;
+	auto binTile{ [&]( const Tile& tile ) {
+		std::vector<uint32_t>& tileLights{ m_TileLightIndices[&tile - m_Tiles.data()] };
+		tileLights.clear();
+		tileLights.reserve( pointLights.size() ); // Room for every light, so moving the camera never allocates
 
-		// To screenspace
-		vertexOut.position.x = ( 1.f + vertexOut.position.x ) * 0.5f * m_Width;
-		vertexOut.position.y = ( 1.f - vertexOut.position.y ) * 0.5f * m_Height;
+		// Depth bounds of whatever the tile shows, a tile that shows nothing needs no lights
+		float minDepth{ std::numeric_limits<float>::max() };
+		float maxDepth{};
+		for ( int py{ tile.top }; py < tile.bottom; ++py )
+		{
+			const float* pRow{ &m_DepthBufferPixels[py * m_Width] };
+			for ( int px{ tile.left }; px < tile.right; ++px )
+			{
+				if ( pRow[px] <= 1.f )
+				{
+					minDepth = std::min( minDepth, pRow[px] );
+					maxDepth = std::max( maxDepth, pRow[px] );
+				}
+			}
+		}
+		if ( minDepth > maxDepth )
+		{
+			return;
+		}
+
+		// The sides go through the camera and the edges of the tile, in the same order as the view frustum
+		const float ndcLeft{ static_cast<float>( tile.left ) / projection.halfWidth - 1.f };
+		const float ndcRight{ static_cast<float>( tile.right ) / projection.halfWidth - 1.f };
+		const float ndcTop{ 1.f - static_cast<float>( tile.top ) / projection.halfHeight };
+		const float ndcBottom{ 1.f - static_cast<float>( tile.bottom ) / projection.halfHeight };
+		const FrustumPlanes planes{
+			Plane{ { 0.f, 0.f, 1.f }, -projection.ToViewDepth( minDepth ) },
+			Plane{ { 0.f, 0.f, -1.f }, projection.ToViewDepth( maxDepth ) },
+			Plane{ Vector3{ projection.scaleX, 0.f, -ndcLeft }.Normalized(), 0.f },
+			Plane{ Vector3{ -projection.scaleX, 0.f, ndcRight }.Normalized(), 0.f },
+			Plane{ Vector3{ 0.f, -projection.scaleY, ndcTop }.Normalized(), 0.f },
+			Plane{ Vector3{ 0.f, projection.scaleY, -ndcBottom }.Normalized(), 0.f },
+		};
 
-		verticesOut[index] = vertexOut;
+		for ( uint32_t lightIndex{}; lightIndex < pointLights.size(); ++lightIndex )
+		{
+			const Light& light{ pointLights[lightIndex] };
+			if ( light.range <= 0.f || std::all_of( planes.begin(), planes.end(), [&]( const Plane& plane ) {
+					 return plane.GetSignedDistance( light.vector ) >= -light.range;
+				 } ) )
+			{
+				tileLights.push_back( lightIndex );
+			}
+		}
 	} };
 
-#ifdef PARALLEL_PROJECT
-	std::for_each( std::execution::par, vertexIndices.begin(), vertexIndices.end(), projectVertex );
+	const std::span<Tile> tiles{ GetTiles() };
+#ifdef PARALLEL_LIGHT_BINNING
+	std::for_each( std::execution::par, tiles.begin(), tiles.end(), binTile );
 #endif
-#ifndef PARALLEL_PROJECT
-	for ( const auto& vertexIndex : vertexIndices )
-	{
-		projectVertex( vertexIndex );
-	}
+#ifndef PARALLEL_LIGHT_BINNING
+	std::for_each( tiles.begin(), tiles.end(), binTile );
 #endif
 }
 
-bool Renderer::IsInPixel( const TriangleOut& triangle, int px, int py, Vector3& baryCentricPosition ) noexcept
+void Renderer::InterpolateVisibleTriangle( const Mesh& mesh,
+											const MeshGeometry& geometry,
+											uint32_t primitiveIndex,
+											const Vector3& viewPosition,
+											VertexOut& pixelVertex ) const noexcept
 {
-	const Vector2 screenSpace{ px + 0.5f, py + 0.5f };
-
-	const std::array<Vector2, 3> triangle2d{ triangle.v0.position.GetXY(),
-											 triangle.v1.position.GetXY(),
-											 triangle.v2.position.GetXY() };
+	const size_t firstIndex{ mesh.primitiveTopology == PrimitiveTopology::TriangleList ? primitiveIndex * 3
+																						: primitiveIndex };
+	const VertexOut& vertex0{ geometry.vertices[mesh.GetIndex( firstIndex + 0 )] };
+	const VertexOut& vertex1{ geometry.vertices[mesh.GetIndex( firstIndex + 1 )] };
+	const VertexOut& vertex2{ geometry.vertices[mesh.GetIndex( firstIndex + 2 )] };
+
+	// Where the ray through the pixel hits the triangle, every weight is the volume spanned by the ray and the opposite edge
+	// This stays perspective correct and does not care whether the triangle got clipped
+	// The camera sits at the origin of view space, so the positions double as the directions from it
+	const float volume0{ Vector3::Dot( viewPosition, Vector3::Cross( vertex1.viewPosition, vertex2.viewPosition ) ) };
+	const float volume1{ Vector3::Dot( viewPosition, Vector3::Cross( vertex2.viewPosition, vertex0.viewPosition ) ) };
+	const float volume2{ Vector3::Dot( viewPosition, Vector3::Cross( vertex0.viewPosition, vertex1.viewPosition ) ) };
+	const float inverseVolume{ 1.f / ( volume0 + volume1 + volume2 ) };
+	const float weight0{ volume0 * inverseVolume };
+	const float weight1{ volume1 * inverseVolume };
+	const float weight2{ 1.f - weight0 - weight1 };
+
+	pixelVertex.uv = vertex0.uv * weight0 + vertex1.uv * weight1 + vertex2.uv * weight2;
+	pixelVertex.normal = ( vertex0.normal * weight0 + vertex1.normal * weight1 + vertex2.normal * weight2 ).Normalized();
+	pixelVertex.tangent =
+		( vertex0.tangent * weight0 + vertex1.tangent * weight1 + vertex2.tangent * weight2 ).Normalized();
+}
 
-	std::array<float, 3> baryBuffer{};
-	const float parallelogramArea{ Vector2::Cross( ( triangle2d[1] - triangle2d[0] ),
-												   ( triangle2d[2] - triangle2d[0] ) ) };
+void Renderer::ReserveGeometry( const Mesh& mesh, MeshGeometry& geometry )
+{
+	// Every triangle of the mesh whatever the pass, clipping can still add a few that the first frames grow to
+	const size_t indexCount{ mesh.GetIndexCount() };
+	const size_t triangleCount{ mesh.primitiveTopology == PrimitiveTopology::TriangleList
+									? indexCount / 3
+									: std::max( indexCount, size_t{ 2 } ) - 2 };
+	geometry.vertices.reserve( mesh.GetVertexCount() );
+	geometry.triangles.reserve( triangleCount );
+	geometry.setups.reserve( triangleCount );
+	geometry.attributePlanes.reserve( triangleCount );
+	geometry.triangleIds.reserve( triangleCount );
+
+	// Meshlet culling only starts once the mesh crosses the frustum
+	const size_t batchCount{ ( mesh.GetVertexCount() + VERTEX_BATCH_SIZE - 1 ) / VERTEX_BATCH_SIZE };
+	m_VertexBatches.reserve( batchCount );
+	m_VisibleMeshlets.reserve( mesh.meshlets.size() );
+	m_MeshletBatchMarks.reserve( batchCount );
+	m_MeshletVertexBatches.reserve( batchCount );
+}
 
-	// Prevent floating point precision error-based crashes
-	// This area being 0 or lower could pose issues later down the line
-	if ( parallelogramArea <= 0.f )
+std::span<const size_t> Renderer::GetVertexBatches( size_t vertexCount ) noexcept
+{
+	const size_t batchCount{ ( vertexCount + VERTEX_BATCH_SIZE - 1 ) / VERTEX_BATCH_SIZE };
+	// The start of every batch is the same for all meshes, only the biggest mesh so far adds new ones
+	for ( size_t batchIndex{ m_VertexBatches.size() }; batchIndex < batchCount; ++batchIndex )
 	{
-		return false;
+		m_VertexBatches.push_back( batchIndex * VERTEX_BATCH_SIZE );
 	}
+	return { m_VertexBatches.data(), batchCount };
+}
 
-	for ( int offset{}; offset < 3; ++offset )
-	{
-		int nextOffset{ ( offset + 1 ) % 3 };
-		const Vector2 vertex{ triangle2d[offset] };
-		const Vector2 nextVertex{ triangle2d[nextOffset] };
-		const Vector2 edgeVector{ nextVertex - vertex };
-		const Vector2 vertexToPixel{ screenSpace - vertex };
+void Renderer::CullMeshlets( const Mesh& mesh, const Camera& camera, const Matrix& modelToView, bool isInsideFrustum ) noexcept
+{
+	const FrustumPlanes planes{ camera.GetFrustumPlanes( static_cast<float>( m_Width ) / m_Height ) };
+	const float scale{ GetLargestScale( modelToView ) };
 
-		const float signedArea{ Vector2::Cross( edgeVector, vertexToPixel ) };
+	const size_t batchCount{ ( mesh.GetVertexCount() + VERTEX_BATCH_SIZE - 1 ) / VERTEX_BATCH_SIZE };
+	m_MeshletBatchMarks.assign( batchCount, false );
+	m_VisibleMeshlets.clear();
+	for ( uint32_t meshletIndex{}; meshletIndex < mesh.meshlets.size(); ++meshletIndex )
+	{
+		const Meshlet& meshlet{ mesh.meshlets[meshletIndex] };
+		const Vector3 sphereCenter{ modelToView.TransformPoint( meshlet.sphereCenter ) };
+		const float sphereRadius{ meshlet.sphereRadius * scale };
 
-		if ( signedArea < 0.f )
+		// Every triangle faces away when the whole sphere sees the cone from behind, the camera sits at the origin
+		const Vector3 coneAxis{ modelToView.TransformVector( meshlet.coneAxis ).Normalized() };
+		if ( Vector3::Dot( sphereCenter, coneAxis ) >= meshlet.coneCutoff * sphereCenter.Magnitude() + sphereRadius )
 		{
-			return false;
+			continue;
 		}
-		else
+
+		// Only a mesh that crosses the frustum can have meshlets outside of it
+		if ( !isInsideFrustum && std::any_of( planes.begin(), planes.end(), [&]( const Plane& plane ) {
+				 return plane.GetSignedDistance( sphereCenter ) < -sphereRadius;
+			 } ) )
 		{
-			const int baryIndex{ ( offset + 2 ) % 3 };
-			baryBuffer[baryIndex] = signedArea / parallelogramArea;
 			continue;
 		}
-	}
 
-	baryCentricPosition = { baryBuffer[0], baryBuffer[1], baryBuffer[2] };
+		m_VisibleMeshlets.push_back( meshletIndex );
+		for ( uint32_t batch{ meshlet.firstBatch }; batch < meshlet.firstBatch + meshlet.batchCount; ++batch )
+		{
+			m_MeshletBatchMarks[mesh.meshletBatches[batch]] = true;
+		}
+	}
 
-	return true;
+	// Meshlets share vertices, every batch still gets projected only once
+	m_MeshletVertexBatches.clear();
+	for ( size_t batchIndex{}; batchIndex < batchCount; ++batchIndex )
+	{
+		if ( m_MeshletBatchMarks[batchIndex] )
+		{
+			m_MeshletVertexBatches.push_back( batchIndex * VERTEX_BATCH_SIZE );
+		}
+	}
 }
 
-bool Renderer::IsCullable( const TriangleOut& triangle ) noexcept
+void Renderer::Project( const Mesh& mesh,
+						std::vector<VertexOut>& verticesOut,
+						const Projection& projection,
+						const Matrix& modelToView,
+						std::span<const size_t> firstVertices ) noexcept
 {
-	// Backface Culling
-	if ( triangle.normal.z > 0.f ) // positive Z is forward -> away from the screen
-	{
-		return true;
-	}
+	assert( ( mesh.isCompressed || mesh.positionsX.size() >= mesh.vertices.size() ) && "Position streams are out of date" );
 
-	// Frustum Culling
-	if ( triangle.v0.position.z > 1.f || triangle.v0.position.z < 0.f )
-	{
-		return true;
-	}
-	if ( triangle.v1.position.z > 1.f || triangle.v1.position.z < 0.f )
-	{
-		return true;
-	}
-	if ( triangle.v2.position.z > 1.f || triangle.v2.position.z < 0.f )
-	{
-		return true;
-	}
+	// Every vertex that gets used is overwritten, so the buffer only needs to be the right size
+	const size_t vertexCount{ mesh.GetVertexCount() };
+	verticesOut.resize( vertexCount );
 
-	// ScreenSpace Culling
-	if ( triangle.v0.position.x < 0.f || triangle.v0.position.x > m_Width )
-	{
-		return true;
-	}
-	if ( triangle.v1.position.x < 0.f || triangle.v1.position.x > m_Width )
-	{
-		return true;
-	}
-	if ( triangle.v2.position.x < 0.f || triangle.v2.position.x > m_Width )
-	{
-		return true;
-	}
-	if ( triangle.v0.position.y < 0.f || triangle.v0.position.y > m_Height )
-	{
-		return true;
-	}
-	if ( triangle.v1.position.y < 0.f || triangle.v1.position.y > m_Height )
+	const Matrix positionToView{ mesh.isCompressed ? mesh.compressed.dequantization * modelToView : modelToView };
+
+	auto projectBatch{ [&]( const size_t firstVertex ) {
+		ProjectVertexBatch( mesh, firstVertex, modelToView, positionToView, projection, verticesOut );
+	} };
+
+#ifdef PARALLEL_PROJECT
+	std::for_each( std::execution::par, firstVertices.begin(), firstVertices.end(), projectBatch );
+#endif
+#ifndef PARALLEL_PROJECT
+	std::for_each( firstVertices.begin(), firstVertices.end(), projectBatch );
+#endif
+}
+
+bool Renderer::IsCullable( const TriangleOut& triangle, uint32_t outcodeUnion, uint32_t outcodeIntersection ) noexcept
+{
+	// Frustum Culling, all vertices lie outside of the same plane
+	if ( outcodeIntersection & ( OUTSIDE_NEAR | OUTSIDE_FAR | OUTSIDE_LEFT | OUTSIDE_RIGHT | OUTSIDE_TOP | OUTSIDE_BOTTOM ) )
 	{
 		return true;
 	}
-	if ( triangle.v2.position.y < 0.f || triangle.v2.position.y > m_Height )
+
+	// Backface Culling, the projected winding can only be trusted when all vertices lie in front of the camera
+	// Triangles that do get clipped are culled by their winding during setup
+	if ( !( outcodeUnion & OUTSIDE_NEAR ) && triangle.normal.z > 0.f ) // positive Z is forward -> away from the screen
 	{
 		return true;
 	}
@@ -498,5 +1217,5 @@ bool Renderer::IsCullable( const TriangleOut& triangle ) noexcept
 
 bool Renderer::SaveBufferToImage() const
 {
-	return SDL_SaveBMP( m_pBackBuffer, "Rasterizer_ColorBuffer.bmp" );
+	return SDL_SaveBMP( m_pPresentedBuffer, "Rasterizer_ColorBuffer.bmp" );
 }
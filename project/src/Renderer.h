@@ -1,8 +1,14 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <new>
+#include <span>
 #include "Camera.h"
 #include "DataTypes.h"
+#include "Clipping.h"
+#include "GBuffer.h"
+#include "Rasterization.h"
+#include "Shading.h"
 
 struct SDL_Window;
 struct SDL_Surface;
@@ -15,6 +21,32 @@ struct Vertex;
 class Timer;
 class Scene;
 
+// What rasterizing a mesh produces
+enum class RasterPass
+{
+	depthAndAttributes, // Every fragment that passes the depth test gets interpolated
+	depthOnly,			// Fills the depth buffer, nothing else
+	equalDepth,			// After a depth only pass, only the visible fragment gets interpolated
+	visibility,			// Only stores which triangle is visible, the resolve interpolates from there
+};
+
+// What a mesh looks like from the camera, kept until either of them moves
+struct MeshGeometry
+{
+	std::vector<VertexOut> vertices{};
+	std::vector<TriangleOut> triangles{};
+	std::vector<TriangleSetup> setups{};
+	std::vector<AttributePlanes> attributePlanes{}; // Only built for the passes that interpolate
+	std::vector<uint32_t> triangleIds{};			// Only built for the visibility pass
+
+	// Versions of the camera and the mesh transform the geometry was built with
+	uint32_t cameraVersion{};
+	uint32_t transformVersion{};
+	bool hasAttributePlanes{};
+	bool hasTriangleIds{};
+	bool isValid{};
+};
+
 class Renderer final
 {
 public:
@@ -29,6 +61,14 @@ public:
 	void Update( Timer* pTimer );
 	void Render( const Scene* pScene );
 
+	// Renders at a fraction of the window size and stretches the result over it, for frames that do not stay up long
+	void SetReducedResolution( bool isReduced ) noexcept;
+	// Changes whenever a toggle changes what a frame looks like
+	uint32_t GetSettingsVersion() const noexcept;
+	// How many threads resolve a frame at most, zero gives every hardware thread one
+	void SetResolveThreadCount( uint32_t threadCount );
+
+	// Saves the last presented frame, at the resolution it was rendered at
 	bool SaveBufferToImage() const;
 
 private:
@@ -36,33 +76,128 @@ private:
 
 	SDL_Surface* m_pFrontBuffer{ nullptr };
 	SDL_Surface* m_pBackBuffer{ nullptr };
-	uint32_t* m_pBackBufferPixels{};
+	SDL_Surface* m_pReducedBackBuffer{ nullptr };
+	uint32_t* m_pBackBufferPixels{}; // Pixels of whichever back buffer is rendered to
+	SDL_Surface* m_pPresentedBuffer{ nullptr }; // Back buffer of the last frame that reached the window
 
-	std::vector<float> m_DepthBufferPixels{};
-	std::vector<std::pair<bool, VertexOut>> m_PixelAttributeBuffer{};
+	// Divides both sides of the window while rendering at reduced resolution
+	static constexpr int m_ReducedResolutionDivisor{ 2 };
+	bool m_IsReducedResolution{};
 
+	std::vector<float> m_DepthBufferPixels{};
+	GBuffer m_GBuffer{};
+	std::vector<uint32_t> m_VisibilityBuffer{};
+
+	static constexpr int m_TileSize{ 64 };
+	static constexpr int m_TileCoarseBlocks{ m_TileSize / COARSE_BLOCK_SIZE };
+	static_assert( m_TileCoarseBlocks * m_TileCoarseBlocks <= 64, "Stale coarse blocks are tracked in a 64 bit mask" );
+	int m_TileCountX{};
+	int m_TileCountY{};
+	std::vector<Tile> m_Tiles{};
+
+	// Projected triangles of every mesh, kept between frames so they neither get allocated nor rebuilt again
+	std::vector<MeshGeometry> m_MeshGeometries{};
+	std::vector<size_t> m_VertexBatches{}; // First vertex of every batch
+
+	// What survived meshlet culling for the mesh that is being assembled
+	std::vector<uint32_t> m_VisibleMeshlets{};
+	std::vector<bool> m_MeshletBatchMarks{};
+	std::vector<size_t> m_MeshletVertexBatches{};
+
+	// The lights of the scene moved into view space, where shading happens
+	std::vector<Light> m_ViewSpaceLights{};
+	std::vector<PixelShader> m_MeshShaders{}; // Specialization every mesh gets shaded with this frame
+	std::vector<BatchShader> m_MeshBatchShaders{};
+	// Indices of the view space point lights that can reach the pixels of every tile, binned once a frame
+	std::vector<std::vector<uint32_t>> m_TileLightIndices{};
+
+	// The resolve hands bands of rows to its workers, every band starts on a new cache line of the back buffer
+	static constexpr int m_ResolveBandRows{ 8 };
+	static constexpr int m_CacheLineSize{ 64 };
+	static constexpr std::align_val_t m_BackBufferAlignment{ m_CacheLineSize };
+	std::vector<uint32_t> m_ResolveWorkers{}; // Index of every worker
+
+	// Size of what gets rendered, the buffers are sized for the whole window and get used from their start
 	int m_Width{};
 	int m_Height{};
 
+	uint32_t m_SettingsVersion{};
+
 	LightingMode m_LightingMode{ LightingMode::combined };
 
 	bool m_ShowDepthBuffer{};
 	bool m_UseNormalMap{ true };
+	bool m_UseDepthPrepass{};
+	bool m_UseVisibilityBuffer{};
+	bool m_UseFastShadingMath{}; // Trades std::pow for an approximation that stays well below a color step
 
 	bool m_F4Held{};
 	bool m_F6Held{};
 	bool m_F7Held{};
-
-	void Project( const std::vector<Vertex>& verticesIn,
+	bool m_F8Held{};
+	bool m_F9Held{};
+	bool m_F11Held{};
+
+	// Grows the buffers of the mesh to what it holds unclipped, the tile bins keep whatever they grew to instead
+	void ReserveGeometry( const Mesh& mesh, MeshGeometry& geometry );
+	// First vertex of every batch of a mesh with this many vertices
+	std::span<const size_t> GetVertexBatches( size_t vertexCount ) noexcept;
+	// Fills the visible meshlets and the vertex batches they need, the frustum is only tested when the mesh crosses it
+	void CullMeshlets( const Mesh& mesh, const Camera& camera, const Matrix& modelToView, bool isInsideFrustum ) noexcept;
+	// Projects the given batches of vertices of the mesh
+	void Project( const Mesh& mesh,
 				  std::vector<VertexOut>& verticesOut,
-				  const Camera& camera,
-				  const Matrix& modelToWorld,
-				  const Matrix& worldToCamera ) const noexcept;
-	void RasterizeMesh( const Mesh& mesh, const Scene* pScene, const Matrix& worldToCamera ) noexcept;
+				  const Projection& projection,
+				  const Matrix& modelToView,
+				  std::span<const size_t> firstVertices ) noexcept;
+	// Lays the tiles out over the current resolution
+	void LayoutTiles() noexcept;
+	// Only the tiles that lie on the current resolution
+	std::span<Tile> GetTiles() noexcept;
+	void RasterizeMesh( const Mesh& mesh,
+						uint16_t meshId,
+						const Scene* pScene,
+						const Matrix& worldToCamera,
+						RasterPass pass,
+						bool isInsideFrustum ) noexcept;
+	// Projects, clips and sets up every triangle of the mesh
+	// The outcodes are only computed when the mesh is not entirely inside the frustum
+	void AssembleMesh( const Mesh& mesh,
+					   uint16_t meshId,
+					   const Camera& camera,
+					   const Matrix& worldToCamera,
+					   RasterPass pass,
+					   bool isInsideFrustum,
+					   MeshGeometry& geometry ) noexcept;
+	void AddTriangle( const TriangleOut& triangle,
+					  uint16_t meshId,
+					  uint32_t primitiveIndex,
+					  RasterPass pass,
+					  MeshGeometry& geometry ) noexcept;
+	void BinTriangles( const MeshGeometry& geometry ) noexcept;
+	void RasterizeTriangle( const TriangleSetup& setup,
+							const TriangleOut& triangle,
+							const AttributePlanes* pPlanes,
+							uint32_t triangleId,
+							Tile& tile,
+							RasterPass pass ) noexcept;
+	void UpdateTileDepthBounds( Tile& tile ) noexcept;
+	void InterpolateBlock( int blockX,
+						   int blockY,
+						   uint32_t passedMask,
+						   const BlockOutput& blockOutput,
+						   const AttributePlanes& planes ) noexcept;
+	// Keeps the point lights whose range reaches into the depth bounds of a tile
+	void BinLights( const Projection& projection, std::span<const Light> pointLights ) noexcept;
+	void Resolve( const Scene* pScene ) noexcept;
+	void InterpolateVisibleTriangle( const Mesh& mesh,
+									 const MeshGeometry& geometry,
+									 uint32_t primitiveIndex,
+									 const Vector3& viewPosition,
+									 VertexOut& pixelVertex ) const noexcept;
 	void ShadePixel( int px, int py, const VertexOut& attributes );
 
-	bool IsInPixel( const TriangleOut& triangle, int px, int py, Vector3& baryCentricPosition ) noexcept;
-	bool IsCullable( const TriangleOut& triangle ) noexcept;
+	bool IsCullable( const TriangleOut& triangle, uint32_t outcodeUnion, uint32_t outcodeIntersection ) noexcept;
 };
 } // namespace dae
 
@@ -1,9 +1,36 @@
 #include "Scene.h"
 #include <SDL_keyboard.h>
+#include <SDL_log.h>
 #include "DataTypes.h"
+#include "MeshOptimizer.h"
 #include "Utils.h"
 using namespace dae;
 
+namespace
+{
+// Loaded meshes trade a bit of precision for a fraction of the memory, see CompressMesh
+constexpr bool COMPRESS_LOADED_MESHES{ true };
+
+// Reports how much OptimizeMesh helped the vertex cache, see GetACMR
+void LogVertexCacheStatistics( const char* pMeshName, const VertexCacheStatistics& statistics )
+{
+	SDL_Log( "%s ACMR: %.3f before optimizing, %.3f after", pMeshName, statistics.acmrBefore, statistics.acmrAfter );
+}
+
+// Last step of loading a mesh, after it has been optimized
+void FinishMesh( Mesh& mesh )
+{
+	if constexpr ( COMPRESS_LOADED_MESHES )
+	{
+		CompressMesh( mesh );
+	}
+	else
+	{
+		mesh.UpdatePositionStreams();
+	}
+}
+} // namespace
+
 // Scene base
 Scene::Scene( const Camera& camera, const std::vector<Mesh>& meshes )
 	: m_Camera{ camera }
@@ -22,6 +49,11 @@ const Camera& Scene::GetCamera() const
 	return m_Camera;
 }
 
+Camera& Scene::GetCamera()
+{
+	return m_Camera;
+}
+
 const std::vector<Mesh>& Scene::GetMeshes() const
 {
 	return m_Meshes;
@@ -32,6 +64,17 @@ const std::vector<Light>& Scene::GetLights() const
 	return m_Lights;
 }
 
+uint32_t Scene::GetTransformVersion() const
+{
+	// Every version only ever goes up, so their sum does too
+	uint32_t version{};
+	for ( const Mesh& mesh : m_Meshes )
+	{
+		version += mesh.transformVersion;
+	}
+	return version;
+}
+
 void Scene::Update( Timer* pTimer )
 {
 	m_Camera.Update( pTimer );
@@ -57,6 +100,7 @@ void SceneW1::Initialize()
 	triangle.vertices = { v0, v1, v2 };
 	triangle.indices = { 0, 1, 2 };
 	triangle.primitiveTopology = PrimitiveTopology::TriangleList;
+	triangle.UpdatePositionStreams();
 
 	Vertex v3{ Vector3{ 1.f, 2.f, 0.5f }, ColorRGB{ 1.f, 0.f, 0.f } };
 	Vertex v4{ Vector3{ 2.f, 0.f, 1.f }, ColorRGB{ 0.f, 1.f, 0.f } };
@@ -66,6 +110,7 @@ void SceneW1::Initialize()
 	triangle2.vertices = { v3, v4, v5 };
 	triangle2.indices = { 0, 1, 2 };
 	triangle2.primitiveTopology = PrimitiveTopology::TriangleList;
+	triangle2.UpdatePositionStreams();
 
 	meshes.push_back( std::move( triangle ) );
 	meshes.push_back( std::move( triangle2 ) );
@@ -96,6 +141,7 @@ void SceneW2::Initialize()
 									{ { 3.f, -3.f, -2.f }, colors::Blue, { 1.f, 1.f } } },
 			   std::vector<uint32_t>{ 3, 0, 4, 1, 5, 2, 2, 6, 6, 3, 7, 4, 8, 5 } };
 	mesh.primitiveTopology = PrimitiveTopology::TriangleStrip;
+	mesh.UpdatePositionStreams();
 
 	mesh.texture = Texture{ "./resources/uv_grid_2.png" };
 
@@ -119,6 +165,8 @@ void SceneW4::Initialize()
 	Mesh mesh{};
 	Utils::ParseOBJ( "./resources/tuktuk.obj", mesh.vertices, mesh.indices );
 	mesh.primitiveTopology = PrimitiveTopology::TriangleList;
+	LogVertexCacheStatistics( "tuktuk.obj", OptimizeMesh( mesh, true ) );
+	FinishMesh( mesh );
 
 	mesh.texture = Texture{ "./resources/tuktuk.png" };
 
@@ -150,12 +198,7 @@ void SceneW5::Update( Timer* pTimer )
 	}
 
 	m_Yaw += pTimer->GetElapsed();
-	m_Meshes[0].worldMatrix = Matrix::CreateRotationY( m_Yaw );
-
-	for ( auto& mesh : m_Meshes )
-	{
-		mesh.UpdateMesh();
-	}
+	m_Meshes[0].SetWorldMatrix( Matrix::CreateRotationY( m_Yaw ) );
 }
 
 void SceneW5::Initialize()
@@ -172,10 +215,9 @@ void SceneW5::Initialize()
 	Mesh mesh{};
 	Utils::ParseOBJ( "./resources/vehicle.obj", mesh.vertices, mesh.indices );
 	mesh.primitiveTopology = PrimitiveTopology::TriangleList;
-
-	mesh.transformedVertices = std::vector<Vertex>( mesh.vertices.size() );
-
-	mesh.UpdateMesh();
+	LogVertexCacheStatistics( "vehicle.obj", OptimizeMesh( mesh, false ) );
+	BuildMeshlets( mesh );
+	FinishMesh( mesh );
 
 	mesh.texture = Texture{ "./resources/vehicle_diffuse.png" };
 	mesh.normalMap = Texture{ "./resources/vehicle_normal.png" };
@@ -22,8 +22,11 @@ public:
 	virtual Scene& operator=( Scene&& ) = delete;
 
 	const Camera& GetCamera() const;
+	Camera& GetCamera();
 	const std::vector<Mesh>& GetMeshes() const;
 	const std::vector<Light>& GetLights() const;
+	// Changes whenever any mesh moves, the camera keeps its own version
+	uint32_t GetTransformVersion() const;
 
 	virtual void Update( Timer* pTimer );
 	virtual void Initialize() = 0;
@@ -1,135 +1,872 @@
 #include "Shading.h"
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <utility>
+#include "Rasterization.h"
 #include "Renderer.h"
 
+#if defined( SIMD_AVX2 )
+#	include <immintrin.h>
+#elif defined( SIMD_SSE )
+#	include <emmintrin.h>
+#endif
+
 namespace dae
 {
-ColorRGB GetPixelColor( const Mesh& mesh,
-						const VertexOut& pixelVertex,
-						const Camera& camera,
-						const std::vector<Light>& lights,
-						const LightingMode& lightingMode,
-						bool useNormalMap )
+namespace
+{
+// List of hardcoded values because
+constexpr float DIFFUSE_REFLECTANCE{ 7.f }; // Hardcoded to make up for lack of lights
+constexpr float SHININESS{ 25.f };
+constexpr ColorRGB AMBIENT_LIGHT{ 0.03f, 0.03f, 0.03f };
+// Stands in for a missing gloss map, a missing specular map reflects nothing at all
+constexpr float DEFAULT_GLOSS{ 1.f };
+
+// Fast power as exp2( exponent * log2( base ) ), both fitted by least squares
+// log2 of a mantissa in [1, 2) is off by at most 1.7e-5, the polynomial goes times ( mantissa - 1 )
+constexpr std::array<float, 5> LOG2_COEFFICIENTS{ 1.44187984f, -0.70886455f, 0.41524326f, -0.19351346f, 0.04526690f };
+// Two to the power of a fraction in [0, 1) is off by at most 4e-6 relative
+// The polynomial goes times the fraction, plus one
+constexpr std::array<float, 4> EXP2_COEFFICIENTS{ 0.69301750f, 0.24144876f, 0.05194775f, 0.01358178f };
+// Anything below the smallest normal float comes out as zero, like std::pow does, so no denormals reach the lights
+constexpr float MIN_EXP2_INPUT{ -126.f };
+constexpr uint32_t FLOAT_EXPONENT_BIAS{ 127 };
+constexpr int FLOAT_MANTISSA_BITS{ 23 };
+constexpr uint32_t FLOAT_MANTISSA_MASK{ ( 1u << FLOAT_MANTISSA_BITS ) - 1 };
+constexpr uint32_t FLOAT_ONE_BITS{ FLOAT_EXPONENT_BIAS << FLOAT_MANTISSA_BITS };
+
+// Done in the same order as the lanes below, so a pixel comes out the same either way
+float FastLog2( float value ) noexcept
+{
+	const uint32_t bits{ std::bit_cast<uint32_t>( value ) };
+	const float exponent{ static_cast<float>( static_cast<int>( bits >> FLOAT_MANTISSA_BITS ) -
+											  static_cast<int>( FLOAT_EXPONENT_BIAS ) ) };
+	const float fraction{ std::bit_cast<float>( ( bits & FLOAT_MANTISSA_MASK ) | FLOAT_ONE_BITS ) - 1.f };
+	const auto& c{ LOG2_COEFFICIENTS };
+	return exponent +
+		   fraction * ( c[0] + fraction * ( c[1] + fraction * ( c[2] + fraction * ( c[3] + fraction * c[4] ) ) ) );
+}
+
+float FastExp2( float value ) noexcept
+{
+	if ( value < MIN_EXP2_INPUT )
+	{
+		return 0.f;
+	}
+	const float clamped{ std::max( value, MIN_EXP2_INPUT ) };
+	const float whole{ std::floor( clamped ) };
+	const float fraction{ clamped - whole };
+	const auto& c{ EXP2_COEFFICIENTS };
+	const float power{ 1.f + fraction * ( c[0] + fraction * ( c[1] + fraction * ( c[2] + fraction * c[3] ) ) ) };
+	return std::bit_cast<float>( std::bit_cast<uint32_t>( power ) +
+								 ( static_cast<uint32_t>( static_cast<int>( whole ) ) << FLOAT_MANTISSA_BITS ) );
+}
+
+// Everything about the surface under a pixel that the lights need, sampled once before looping over them
+struct Surface
+{
+	Vector3 position{};
+	Vector3 normal{};
+	Vector3 toCameraDir{};
+	ColorRGB lambertDiffuse{};
+	ColorRGB specularity{};
+	float gloss{};
+};
+
+// Tiles only shade with the point lights whose range reaches them, so every mode fades a light out over its range
+template <LightType lightType>
+float GetLightFalloff( const Light& light, const Vector3& position )
 {
-	const ColorRGB diffuseColor{ mesh.texture.Sample( pixelVertex.uv ) };
+	if constexpr ( lightType == LightType::point )
+	{
+		return lightUtils::GetRangeFalloff( light, ( light.vector - position ).SqrMagnitude() );
+	}
+	else
+	{
+		return 1.f;
+	}
+}
 
-	if ( lights.empty() )
+template <LightingMode lightingMode, LightType lightType, bool useFastMath>
+void AddLight( const Light& light, const Surface& surface, ColorRGB& finalColor )
+{
+	if constexpr ( lightingMode == LightingMode::observedArea )
+	{
+		const float observedArea{ lightUtils::GetObservedArea<lightType>( light, surface.position, surface.normal ) *
+								  GetLightFalloff<lightType>( light, surface.position ) };
+		finalColor += ColorRGB{ observedArea, observedArea, observedArea };
+	}
+	else if constexpr ( lightingMode == LightingMode::diffuse )
+	{
+		finalColor += surface.lambertDiffuse * GetLightFalloff<lightType>( light, surface.position );
+	}
+	else
 	{
-		return diffuseColor;
+		Vector3 lightToPoint{};
+		if constexpr ( lightType == LightType::point )
+		{
+			lightToPoint = Vector3{ light.vector, surface.position }.Normalized();
+		}
+		else
+		{
+			lightToPoint = light.vector;
+		}
+		const ColorRGB phongSpecular{ lightUtils::GetPhong<useFastMath>(
+			surface.specularity, surface.gloss * SHININESS, lightToPoint, surface.toCameraDir, surface.normal ) };
+
+		if constexpr ( lightingMode == LightingMode::specular )
+		{
+			finalColor += phongSpecular * GetLightFalloff<lightType>( light, surface.position );
+		}
+		else
+		{
+			const float observedArea{ lightUtils::GetObservedArea<lightType>( light, surface.position, surface.normal ) };
+			const ColorRGB radiance{ lightUtils::GetRadiance<lightType>( light, surface.position ) };
+			const ColorRGB brdf{ surface.lambertDiffuse + phongSpecular + AMBIENT_LIGHT };
+			finalColor += observedArea * radiance * brdf;
+		}
 	}
+}
+
+// Only samples the maps the lighting mode needs and the mesh has
+template <LightingMode lightingMode, bool useNormalMap, bool hasSpecularMap, bool hasGlossMap, bool useFastMath>
+ColorRGB ShadeLit( const Mesh& mesh,
+				   const VertexOut& pixelVertex,
+				   const Vector3& cameraPosition,
+				   const ShadingLights& lights )
+{
+	constexpr bool needsDiffuse{ lightingMode == LightingMode::diffuse || lightingMode == LightingMode::combined };
+	constexpr bool needsSpecular{ lightingMode == LightingMode::specular || lightingMode == LightingMode::combined };
 
-	const Vector3 pixelPos{ pixelVertex.position.x, pixelVertex.position.y, pixelVertex.position.w };
+	Surface surface{};
+	surface.position = { pixelVertex.position.x, pixelVertex.position.y, pixelVertex.position.w };
 
-	Vector3 sampledNormal{};
-	if ( useNormalMap )
+	if constexpr ( useNormalMap )
 	{
 		const Vector3 binormal{ Vector3::Cross( pixelVertex.normal, pixelVertex.tangent ).Normalized() };
 		const Matrix tangentAxisSpace{ pixelVertex.tangent, binormal, pixelVertex.normal, {} };
 		ColorRGB sampledNormalColor{ ( mesh.normalMap.Sample( pixelVertex.uv ) ) };
-		sampledNormal = { sampledNormalColor.r, sampledNormalColor.g, sampledNormalColor.b };
+		Vector3 sampledNormal{ sampledNormalColor.r, sampledNormalColor.g, sampledNormalColor.b };
 		sampledNormal = ( sampledNormal * 2.f ) - Vector3{ 1.f, 1.f, 1.f };
 		sampledNormal = tangentAxisSpace.TransformVector( sampledNormal );
-		sampledNormal.Normalize();
+		surface.normal = sampledNormal.Normalized();
 	}
 	else
 	{
-		sampledNormal = pixelVertex.normal;
+		surface.normal = pixelVertex.normal;
 	}
 
-	const ColorRGB sampledSpecularity{ mesh.specularMap.Sample( pixelVertex.uv ) };
-	const float sampledGloss{ mesh.glossMap.Sample( pixelVertex.uv ).r }; // Assuming map is greyscale
+	if constexpr ( needsDiffuse )
+	{
+		surface.lambertDiffuse = ( mesh.texture.Sample( pixelVertex.uv ) * DIFFUSE_REFLECTANCE ) / PI;
+	}
 
-	const Vector3 toCameraDir{ Vector3( pixelPos, camera.GetPosition() ).Normalized() };
+	if constexpr ( needsSpecular )
+	{
+		if constexpr ( hasSpecularMap )
+		{
+			surface.specularity = mesh.specularMap.Sample( pixelVertex.uv );
+		}
+		if constexpr ( hasGlossMap )
+		{
+			surface.gloss = mesh.glossMap.Sample( pixelVertex.uv ).r; // Assuming map is greyscale
+		}
+		else
+		{
+			surface.gloss = DEFAULT_GLOSS;
+		}
+		surface.toCameraDir = Vector3( surface.position, cameraPosition ).Normalized();
+	}
 
 	ColorRGB finalColor{};
-	for ( auto& light : lights )
+	for ( const Light& light : lights.directional )
 	{
-		Vector3 lightToPoint{};
-		switch ( light.type )
+		AddLight<lightingMode, LightType::directional, useFastMath>( light, surface, finalColor );
+	}
+	for ( const uint32_t lightIndex : lights.pointIndices )
+	{
+		AddLight<lightingMode, LightType::point, useFastMath>( lights.point[lightIndex], surface, finalColor );
+	}
+
+	finalColor.MaxToOne();
+
+	return finalColor;
+}
+
+// Without lights there is nothing to shade, the texture shows as it is
+ColorRGB ShadeUnlit( const Mesh& mesh, const VertexOut& pixelVertex, const Vector3&, const ShadingLights& )
+{
+	return mesh.texture.Sample( pixelVertex.uv );
+}
+
+// One float per pixel of a batch, the shading math is written once on top of it
+#if defined( SIMD_AVX2 )
+struct Lanes
+{
+	__m256 values;
+
+	static Lanes Load( const float* pValues ) noexcept
+	{
+		return { _mm256_load_ps( pValues ) };
+	}
+	static Lanes Splat( float value ) noexcept
+	{
+		return { _mm256_set1_ps( value ) };
+	}
+	void Store( float* pValues ) const noexcept
+	{
+		_mm256_store_ps( pValues, values );
+	}
+
+	friend Lanes operator+( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return { _mm256_add_ps( lhs.values, rhs.values ) };
+	}
+	friend Lanes operator-( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return { _mm256_sub_ps( lhs.values, rhs.values ) };
+	}
+	friend Lanes operator*( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return { _mm256_mul_ps( lhs.values, rhs.values ) };
+	}
+	friend Lanes operator/( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return { _mm256_div_ps( lhs.values, rhs.values ) };
+	}
+	friend Lanes Max( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return { _mm256_max_ps( lhs.values, rhs.values ) };
+	}
+	friend Lanes Sqrt( Lanes lanes ) noexcept
+	{
+		return { _mm256_sqrt_ps( lanes.values ) };
+	}
+	friend Lanes Floor( Lanes lanes ) noexcept
+	{
+		return { _mm256_floor_ps( lanes.values ) };
+	}
+
+	// Unbiased exponent of every float and its mantissa in [1, 2)
+	friend Lanes GetExponent( Lanes lanes ) noexcept
+	{
+		const __m256i bits{ _mm256_castps_si256( lanes.values ) };
+		return { _mm256_cvtepi32_ps( _mm256_sub_epi32( _mm256_srli_epi32( bits, FLOAT_MANTISSA_BITS ),
+													   _mm256_set1_epi32( FLOAT_EXPONENT_BIAS ) ) ) };
+	}
+	friend Lanes GetMantissa( Lanes lanes ) noexcept
+	{
+		const __m256i bits{ _mm256_castps_si256( lanes.values ) };
+		return { _mm256_castsi256_ps( _mm256_or_si256( _mm256_and_si256( bits, _mm256_set1_epi32( FLOAT_MANTISSA_MASK ) ),
+													   _mm256_set1_epi32( FLOAT_ONE_BITS ) ) ) };
+	}
+	// Adds whole numbers to the exponents
+	friend Lanes AddExponent( Lanes lanes, Lanes whole ) noexcept
+	{
+		const __m256i shifted{ _mm256_slli_epi32( _mm256_cvtps_epi32( whole.values ), FLOAT_MANTISSA_BITS ) };
+		return { _mm256_castsi256_ps( _mm256_add_epi32( _mm256_castps_si256( lanes.values ), shifted ) ) };
+	}
+	friend Lanes ZeroWhereBelow( Lanes lanes, Lanes tested, Lanes limit ) noexcept
+	{
+		return { _mm256_and_ps( lanes.values, _mm256_cmp_ps( tested.values, limit.values, _CMP_GE_OQ ) ) };
+	}
+};
+#elif defined( SIMD_SSE )
+// Two halves of four
+struct Lanes
+{
+	__m128 low;
+	__m128 high;
+
+	static Lanes Load( const float* pValues ) noexcept
+	{
+		return { _mm_load_ps( pValues ), _mm_load_ps( pValues + 4 ) };
+	}
+	static Lanes Splat( float value ) noexcept
+	{
+		return { _mm_set1_ps( value ), _mm_set1_ps( value ) };
+	}
+	void Store( float* pValues ) const noexcept
+	{
+		_mm_store_ps( pValues, low );
+		_mm_store_ps( pValues + 4, high );
+	}
+
+	friend Lanes operator+( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return { _mm_add_ps( lhs.low, rhs.low ), _mm_add_ps( lhs.high, rhs.high ) };
+	}
+	friend Lanes operator-( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return { _mm_sub_ps( lhs.low, rhs.low ), _mm_sub_ps( lhs.high, rhs.high ) };
+	}
+	friend Lanes operator*( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return { _mm_mul_ps( lhs.low, rhs.low ), _mm_mul_ps( lhs.high, rhs.high ) };
+	}
+	friend Lanes operator/( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return { _mm_div_ps( lhs.low, rhs.low ), _mm_div_ps( lhs.high, rhs.high ) };
+	}
+	friend Lanes Max( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return { _mm_max_ps( lhs.low, rhs.low ), _mm_max_ps( lhs.high, rhs.high ) };
+	}
+	friend Lanes Sqrt( Lanes lanes ) noexcept
+	{
+		return { _mm_sqrt_ps( lanes.low ), _mm_sqrt_ps( lanes.high ) };
+	}
+	// SSE2 has no rounding, a truncation that went up gets one taken off
+	friend Lanes Floor( Lanes lanes ) noexcept
+	{
+		const auto floorHalf{ []( __m128 values ) {
+			const __m128 truncated{ _mm_cvtepi32_ps( _mm_cvttps_epi32( values ) ) };
+			return _mm_sub_ps( truncated, _mm_and_ps( _mm_cmpgt_ps( truncated, values ), _mm_set1_ps( 1.f ) ) );
+		} };
+		return { floorHalf( lanes.low ), floorHalf( lanes.high ) };
+	}
+
+	// Unbiased exponent of every float and its mantissa in [1, 2)
+	friend Lanes GetExponent( Lanes lanes ) noexcept
+	{
+		const auto exponentHalf{ []( __m128 values ) {
+			return _mm_cvtepi32_ps( _mm_sub_epi32( _mm_srli_epi32( _mm_castps_si128( values ), FLOAT_MANTISSA_BITS ),
+												   _mm_set1_epi32( FLOAT_EXPONENT_BIAS ) ) );
+		} };
+		return { exponentHalf( lanes.low ), exponentHalf( lanes.high ) };
+	}
+	friend Lanes GetMantissa( Lanes lanes ) noexcept
+	{
+		const auto mantissaHalf{ []( __m128 values ) {
+			return _mm_castsi128_ps( _mm_or_si128( _mm_and_si128( _mm_castps_si128( values ),
+																   _mm_set1_epi32( FLOAT_MANTISSA_MASK ) ),
+												   _mm_set1_epi32( FLOAT_ONE_BITS ) ) );
+		} };
+		return { mantissaHalf( lanes.low ), mantissaHalf( lanes.high ) };
+	}
+	// Adds whole numbers to the exponents
+	friend Lanes AddExponent( Lanes lanes, Lanes whole ) noexcept
+	{
+		const auto addHalf{ []( __m128 values, __m128 wholeValues ) {
+			const __m128i shifted{ _mm_slli_epi32( _mm_cvtps_epi32( wholeValues ), FLOAT_MANTISSA_BITS ) };
+			return _mm_castsi128_ps( _mm_add_epi32( _mm_castps_si128( values ), shifted ) );
+		} };
+		return { addHalf( lanes.low, whole.low ), addHalf( lanes.high, whole.high ) };
+	}
+	friend Lanes ZeroWhereBelow( Lanes lanes, Lanes tested, Lanes limit ) noexcept
+	{
+		return { _mm_and_ps( lanes.low, _mm_cmpge_ps( tested.low, limit.low ) ),
+				 _mm_and_ps( lanes.high, _mm_cmpge_ps( tested.high, limit.high ) ) };
+	}
+};
+#else
+struct Lanes
+{
+	std::array<float, SHADING_BATCH_SIZE> values;
+
+	template <typename Operation>
+	static Lanes Apply( Lanes lhs, Lanes rhs, Operation operation ) noexcept
+	{
+		Lanes result{};
+		for ( size_t lane{}; lane < SHADING_BATCH_SIZE; ++lane )
 		{
-		case LightType::point:
-			lightToPoint = Vector3{ light.vector, pixelPos }.Normalized();
-			break;
+			result.values[lane] = operation( lhs.values[lane], rhs.values[lane] );
+		}
+		return result;
+	}
 
-		case LightType::directional:
-			lightToPoint = light.vector;
-			break;
+	static Lanes Load( const float* pValues ) noexcept
+	{
+		Lanes result{};
+		std::copy( pValues, pValues + SHADING_BATCH_SIZE, result.values.begin() );
+		return result;
+	}
+	static Lanes Splat( float value ) noexcept
+	{
+		Lanes result{};
+		result.values.fill( value );
+		return result;
+	}
+	void Store( float* pValues ) const noexcept
+	{
+		std::copy( values.begin(), values.end(), pValues );
+	}
+
+	friend Lanes operator+( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return Apply( lhs, rhs, []( float a, float b ) { return a + b; } );
+	}
+	friend Lanes operator-( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return Apply( lhs, rhs, []( float a, float b ) { return a - b; } );
+	}
+	friend Lanes operator*( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return Apply( lhs, rhs, []( float a, float b ) { return a * b; } );
+	}
+	friend Lanes operator/( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return Apply( lhs, rhs, []( float a, float b ) { return a / b; } );
+	}
+	friend Lanes Max( Lanes lhs, Lanes rhs ) noexcept
+	{
+		return Apply( lhs, rhs, []( float a, float b ) { return std::max( a, b ); } );
+	}
+	friend Lanes Sqrt( Lanes lanes ) noexcept
+	{
+		return Apply( lanes, lanes, []( float a, float ) { return std::sqrt( a ); } );
+	}
+	friend Lanes Floor( Lanes lanes ) noexcept
+	{
+		return Apply( lanes, lanes, []( float a, float ) { return std::floor( a ); } );
+	}
+
+	// Unbiased exponent of every float and its mantissa in [1, 2)
+	friend Lanes GetExponent( Lanes lanes ) noexcept
+	{
+		return Apply( lanes, lanes, []( float a, float ) {
+			return static_cast<float>( static_cast<int>( std::bit_cast<uint32_t>( a ) >> FLOAT_MANTISSA_BITS ) -
+									   static_cast<int>( FLOAT_EXPONENT_BIAS ) );
+		} );
+	}
+	friend Lanes GetMantissa( Lanes lanes ) noexcept
+	{
+		return Apply( lanes, lanes, []( float a, float ) {
+			return std::bit_cast<float>( ( std::bit_cast<uint32_t>( a ) & FLOAT_MANTISSA_MASK ) | FLOAT_ONE_BITS );
+		} );
+	}
+	// Adds whole numbers to the exponents
+	friend Lanes AddExponent( Lanes lanes, Lanes whole ) noexcept
+	{
+		return Apply( lanes, whole, []( float a, float b ) {
+			return std::bit_cast<float>( std::bit_cast<uint32_t>( a ) +
+										 ( static_cast<uint32_t>( static_cast<int>( b ) ) << FLOAT_MANTISSA_BITS ) );
+		} );
+	}
+	friend Lanes ZeroWhereBelow( Lanes lanes, Lanes tested, Lanes limit ) noexcept
+	{
+		for ( size_t lane{}; lane < SHADING_BATCH_SIZE; ++lane )
+		{
+			lanes.values[lane] = tested.values[lane] >= limit.values[lane] ? lanes.values[lane] : 0.f;
 		}
+		return lanes;
+	}
+};
+#endif
 
-		// List of hardcoded values because
-		constexpr float diffuseReflectance{ 7.f }; // Hardcoded to make up for lack of lights
-		constexpr float shininess{ 25.f };
-		constexpr ColorRGB ambientLight{ 0.03f, 0.03f, 0.03f };
+// Same math as FastLog2 and FastExp2
+Lanes Log2( Lanes lanes ) noexcept
+{
+	const Lanes fraction{ GetMantissa( lanes ) - Lanes::Splat( 1.f ) };
+	const auto c{ [&]( size_t index ) { return Lanes::Splat( LOG2_COEFFICIENTS[index] ); } };
+	return GetExponent( lanes ) +
+		   fraction * ( c( 0 ) + fraction * ( c( 1 ) + fraction * ( c( 2 ) + fraction * ( c( 3 ) + fraction * c( 4 ) ) ) ) );
+}
 
-		const float observedArea{ lightUtils::GetObservedArea( light, pixelPos, sampledNormal ) };
-		const ColorRGB radiance{ lightUtils::GetRadiance( light, pixelPos ) };
-		const ColorRGB lambertDiffuse{ ( diffuseColor * diffuseReflectance ) / PI };
-		const ColorRGB phongSpecular{ lightUtils::GetPhong(
-			sampledSpecularity, sampledGloss * shininess, lightToPoint, toCameraDir, sampledNormal ) };
-		const ColorRGB brdf{ lambertDiffuse + phongSpecular + ambientLight };
+Lanes Exp2( Lanes lanes ) noexcept
+{
+	const Lanes minInput{ Lanes::Splat( MIN_EXP2_INPUT ) };
+	const Lanes clamped{ Max( lanes, minInput ) };
+	const Lanes whole{ Floor( clamped ) };
+	const Lanes fraction{ clamped - whole };
+	const auto c{ [&]( size_t index ) { return Lanes::Splat( EXP2_COEFFICIENTS[index] ); } };
+	const Lanes power{ Lanes::Splat( 1.f ) +
+					   fraction * ( c( 0 ) + fraction * ( c( 1 ) + fraction * ( c( 2 ) + fraction * c( 3 ) ) ) ) };
+	return ZeroWhereBelow( AddExponent( power, whole ), lanes, minInput );
+}
 
-		switch ( lightingMode )
+// The exponent differs per lane with a gloss map, so without fast math every lane takes its own power
+template <bool useFastMath>
+Lanes Pow( Lanes base, Lanes exponent ) noexcept
+{
+	if constexpr ( useFastMath )
+	{
+		return Exp2( exponent * Log2( base ) );
+	}
+	else
+	{
+		alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> bases{};
+		alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> exponents{};
+		base.Store( bases.data() );
+		exponent.Store( exponents.data() );
+		for ( size_t lane{}; lane < SHADING_BATCH_SIZE; ++lane )
 		{
-		case LightingMode::observedArea:
-			finalColor += ColorRGB{ observedArea, observedArea, observedArea };
-			break;
+			bases[lane] = std::pow( bases[lane], exponents[lane] );
+		}
+		return Lanes::Load( bases.data() );
+	}
+}
+
+struct VectorLanes
+{
+	Lanes x;
+	Lanes y;
+	Lanes z;
 
-		case LightingMode::diffuse:
-			finalColor += lambertDiffuse;
-			break;
+	static VectorLanes Splat( const Vector3& vector ) noexcept
+	{
+		return { Lanes::Splat( vector.x ), Lanes::Splat( vector.y ), Lanes::Splat( vector.z ) };
+	}
 
-		case LightingMode::specular:
-			finalColor += phongSpecular;
-			break;
+	friend VectorLanes operator+( const VectorLanes& lhs, const VectorLanes& rhs ) noexcept
+	{
+		return { lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z };
+	}
+	friend VectorLanes operator-( const VectorLanes& lhs, const VectorLanes& rhs ) noexcept
+	{
+		return { lhs.x - rhs.x, lhs.y - rhs.y, lhs.z - rhs.z };
+	}
+	friend VectorLanes operator*( const VectorLanes& lhs, Lanes rhs ) noexcept
+	{
+		return { lhs.x * rhs, lhs.y * rhs, lhs.z * rhs };
+	}
+};
 
-		case LightingMode::combined:
-			finalColor += observedArea * radiance * brdf;
-			break;
+Lanes Dot( const VectorLanes& lhs, const VectorLanes& rhs ) noexcept
+{
+	return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z;
+}
+
+VectorLanes Cross( const VectorLanes& lhs, const VectorLanes& rhs ) noexcept
+{
+	return { lhs.y * rhs.z - lhs.z * rhs.y, lhs.z * rhs.x - lhs.x * rhs.z, lhs.x * rhs.y - lhs.y * rhs.x };
+}
+
+VectorLanes Normalized( const VectorLanes& vector ) noexcept
+{
+	const Lanes magnitude{ Sqrt( Dot( vector, vector ) ) };
+	return { vector.x / magnitude, vector.y / magnitude, vector.z / magnitude };
+}
+
+struct ColorLanes
+{
+	Lanes r;
+	Lanes g;
+	Lanes b;
+
+	static ColorLanes Splat( const ColorRGB& color ) noexcept
+	{
+		return { Lanes::Splat( color.r ), Lanes::Splat( color.g ), Lanes::Splat( color.b ) };
+	}
+
+	friend ColorLanes operator+( const ColorLanes& lhs, const ColorLanes& rhs ) noexcept
+	{
+		return { lhs.r + rhs.r, lhs.g + rhs.g, lhs.b + rhs.b };
+	}
+	friend ColorLanes operator*( const ColorLanes& lhs, const ColorLanes& rhs ) noexcept
+	{
+		return { lhs.r * rhs.r, lhs.g * rhs.g, lhs.b * rhs.b };
+	}
+	friend ColorLanes operator*( const ColorLanes& lhs, Lanes rhs ) noexcept
+	{
+		return { lhs.r * rhs, lhs.g * rhs, lhs.b * rhs };
+	}
+	friend ColorLanes operator/( const ColorLanes& lhs, Lanes rhs ) noexcept
+	{
+		return { lhs.r / rhs, lhs.g / rhs, lhs.b / rhs };
+	}
+};
+
+// Textures get sampled one lane at a time, everything after works on all of them
+ColorLanes SampleLanes( const Texture& texture, const PixelBatch& pixels ) noexcept
+{
+	ColorBatch samples{};
+	for ( size_t lane{}; lane < SHADING_BATCH_SIZE; ++lane )
+	{
+		const ColorRGB sample{ texture.Sample( { pixels.u[lane], pixels.v[lane] } ) };
+		samples.r[lane] = sample.r;
+		samples.g[lane] = sample.g;
+		samples.b[lane] = sample.b;
+	}
+	return { Lanes::Load( samples.r.data() ), Lanes::Load( samples.g.data() ), Lanes::Load( samples.b.data() ) };
+}
+
+void StoreLanes( const ColorLanes& colors, ColorBatch& colorsOut ) noexcept
+{
+	colors.r.Store( colorsOut.r.data() );
+	colors.g.Store( colorsOut.g.data() );
+	colors.b.Store( colorsOut.b.data() );
+}
+
+// Surface of the pixel shader, one lane per pixel
+struct SurfaceLanes
+{
+	VectorLanes position;
+	VectorLanes normal;
+	VectorLanes toCameraDir;
+	ColorLanes lambertDiffuse;
+	ColorLanes specularity;
+	Lanes phongExponent;
+};
+
+// Follows AddLight operation for operation
+template <LightingMode lightingMode, LightType lightType, bool useFastMath>
+void AddLightLanes( const Light& light, const SurfaceLanes& surface, ColorLanes& finalColor ) noexcept
+{
+	const Lanes zero{ Lanes::Splat( 0.f ) };
+	const VectorLanes lightVector{ VectorLanes::Splat( light.vector ) };
+
+	const auto getObservedArea{ [&]() {
+		if constexpr ( lightType == LightType::point )
+		{
+			return Max( Dot( surface.normal, lightVector - surface.position ), zero );
+		}
+		else
+		{
+			return Max( Dot( surface.normal, VectorLanes::Splat( -light.vector ) ), zero );
+		}
+	} };
 
-		default:
-			break;
+	// Same window as lightUtils::GetRangeFalloff, only point lights with a range have one
+	const auto getRangeFalloff{ [&]( const Lanes& sqrDistance ) {
+		const Lanes sqrDistanceRatio{ sqrDistance / Lanes::Splat( light.range * light.range ) };
+		const Lanes window{ Max( Lanes::Splat( 1.f ) - sqrDistanceRatio * sqrDistanceRatio, zero ) };
+		return window * window;
+	} };
+	const auto applyRangeFalloff{ [&]( const ColorLanes& color ) {
+		if constexpr ( lightType == LightType::point )
+		{
+			if ( light.range > 0.f )
+			{
+				const VectorLanes toLight{ lightVector - surface.position };
+				return color * getRangeFalloff( Dot( toLight, toLight ) );
+			}
 		}
+		return color;
+	} };
+
+	if constexpr ( lightingMode == LightingMode::observedArea )
+	{
+		const Lanes observedArea{ getObservedArea() };
+		finalColor = finalColor + applyRangeFalloff( ColorLanes{ observedArea, observedArea, observedArea } );
+	}
+	else if constexpr ( lightingMode == LightingMode::diffuse )
+	{
+		finalColor = finalColor + applyRangeFalloff( surface.lambertDiffuse );
 	}
+	else
+	{
+		VectorLanes lightToPoint{ lightVector };
+		if constexpr ( lightType == LightType::point )
+		{
+			lightToPoint = Normalized( surface.position - lightVector );
+		}
+		const Lanes twiceDot{ Lanes::Splat( 2.f ) * Dot( lightToPoint, surface.normal ) };
+		const VectorLanes reflect{ lightToPoint - surface.normal * twiceDot };
+		const Lanes specularDot{ Max( Dot( reflect, surface.toCameraDir ), zero ) };
+		const ColorLanes phongSpecular{ surface.specularity * Pow<useFastMath>( specularDot, surface.phongExponent ) };
 
-	finalColor.MaxToOne();
+		if constexpr ( lightingMode == LightingMode::specular )
+		{
+			finalColor = finalColor + applyRangeFalloff( phongSpecular );
+		}
+		else
+		{
+			ColorLanes radiance{ ColorLanes::Splat( light.color * light.intensity ) };
+			if constexpr ( lightType == LightType::point )
+			{
+				const VectorLanes toLight{ lightVector - surface.position };
+				const Lanes sqrDistance{ Dot( toLight, toLight ) };
+				Lanes intensity{ Lanes::Splat( light.intensity ) / sqrDistance };
+				if ( light.range > 0.f )
+				{
+					intensity = intensity * getRangeFalloff( sqrDistance );
+				}
+				radiance = ColorLanes::Splat( light.color ) * intensity;
+			}
+			const ColorLanes brdf{ surface.lambertDiffuse + phongSpecular + ColorLanes::Splat( AMBIENT_LIGHT ) };
+			finalColor = finalColor + radiance * getObservedArea() * brdf;
+		}
+	}
+}
 
-	return finalColor;
+// Follows ShadeLit, only the texture samples are not vectorized
+template <LightingMode lightingMode, bool useNormalMap, bool hasSpecularMap, bool hasGlossMap, bool useFastMath>
+void ShadeLitBatch( const Mesh& mesh, const PixelBatch& pixels, const ShadingLights& lights, ColorBatch& colorsOut )
+{
+	constexpr bool needsDiffuse{ lightingMode == LightingMode::diffuse || lightingMode == LightingMode::combined };
+	constexpr bool needsSpecular{ lightingMode == LightingMode::specular || lightingMode == LightingMode::combined };
+
+	const Lanes zero{ Lanes::Splat( 0.f ) };
+	const Lanes one{ Lanes::Splat( 1.f ) };
+
+	SurfaceLanes surface{};
+	surface.position = { Lanes::Load( pixels.positionX.data() ),
+						 Lanes::Load( pixels.positionY.data() ),
+						 Lanes::Load( pixels.positionZ.data() ) };
+	surface.normal = { Lanes::Load( pixels.normalX.data() ),
+					   Lanes::Load( pixels.normalY.data() ),
+					   Lanes::Load( pixels.normalZ.data() ) };
+
+	if constexpr ( useNormalMap )
+	{
+		const VectorLanes tangent{ Lanes::Load( pixels.tangentX.data() ),
+								   Lanes::Load( pixels.tangentY.data() ),
+								   Lanes::Load( pixels.tangentZ.data() ) };
+		const VectorLanes binormal{ Normalized( Cross( surface.normal, tangent ) ) };
+		const ColorLanes sampledNormalColor{ SampleLanes( mesh.normalMap, pixels ) };
+		const Lanes two{ Lanes::Splat( 2.f ) };
+		const Lanes sampledX{ sampledNormalColor.r * two - one };
+		const Lanes sampledY{ sampledNormalColor.g * two - one };
+		const Lanes sampledZ{ sampledNormalColor.b * two - one };
+		surface.normal = Normalized( tangent * sampledX + binormal * sampledY + surface.normal * sampledZ );
+	}
+
+	if constexpr ( needsDiffuse )
+	{
+		surface.lambertDiffuse =
+			( SampleLanes( mesh.texture, pixels ) * Lanes::Splat( DIFFUSE_REFLECTANCE ) ) / Lanes::Splat( PI );
+	}
+
+	if constexpr ( needsSpecular )
+	{
+		surface.specularity = { zero, zero, zero };
+		if constexpr ( hasSpecularMap )
+		{
+			surface.specularity = SampleLanes( mesh.specularMap, pixels );
+		}
+		if constexpr ( hasGlossMap )
+		{
+			surface.phongExponent = SampleLanes( mesh.glossMap, pixels ).r * Lanes::Splat( SHININESS );
+		}
+		else
+		{
+			surface.phongExponent = Lanes::Splat( DEFAULT_GLOSS * SHININESS );
+		}
+		const VectorLanes origin{ zero, zero, zero };
+		surface.toCameraDir = Normalized( origin - surface.position );
+	}
+
+	ColorLanes finalColor{ zero, zero, zero };
+	for ( const Light& light : lights.directional )
+	{
+		AddLightLanes<lightingMode, LightType::directional, useFastMath>( light, surface, finalColor );
+	}
+	for ( const uint32_t lightIndex : lights.pointIndices )
+	{
+		AddLightLanes<lightingMode, LightType::point, useFastMath>( lights.point[lightIndex], surface, finalColor );
+	}
+
+	// MaxToOne, dividing by one leaves the lanes that fit as they are
+	const Lanes maxValue{ Max( finalColor.r, Max( finalColor.g, finalColor.b ) ) };
+	StoreLanes( finalColor / Max( maxValue, one ), colorsOut );
+}
+
+void ShadeUnlitBatch( const Mesh& mesh, const PixelBatch& pixels, const ShadingLights&, ColorBatch& colorsOut )
+{
+	StoreLanes( SampleLanes( mesh.texture, pixels ), colorsOut );
+}
+
+// Every lit permutation, the index holds the lighting mode above a bit for fast math and three bits for the maps
+constexpr size_t FAST_MATH_BIT{ 1 << 3 };
+constexpr size_t NORMAL_MAP_BIT{ 1 << 2 };
+constexpr size_t SPECULAR_MAP_BIT{ 1 << 1 };
+constexpr size_t GLOSS_MAP_BIT{ 1 << 0 };
+constexpr size_t OPTION_PERMUTATIONS{ 1 << 4 };
+
+template <size_t... permutations>
+constexpr std::array<PixelShader, sizeof...( permutations )> MakeLitShaders( std::index_sequence<permutations...> )
+{
+	return { &ShadeLit<static_cast<LightingMode>( permutations / OPTION_PERMUTATIONS ),
+					   ( permutations & NORMAL_MAP_BIT ) != 0,
+					   ( permutations & SPECULAR_MAP_BIT ) != 0,
+					   ( permutations & GLOSS_MAP_BIT ) != 0,
+					   ( permutations & FAST_MATH_BIT ) != 0>... };
+}
+
+template <size_t... permutations>
+constexpr std::array<BatchShader, sizeof...( permutations )> MakeLitBatchShaders( std::index_sequence<permutations...> )
+{
+	return { &ShadeLitBatch<static_cast<LightingMode>( permutations / OPTION_PERMUTATIONS ),
+							( permutations & NORMAL_MAP_BIT ) != 0,
+							( permutations & SPECULAR_MAP_BIT ) != 0,
+							( permutations & GLOSS_MAP_BIT ) != 0,
+							( permutations & FAST_MATH_BIT ) != 0>... };
+}
+
+constexpr auto LIT_SHADERS{ MakeLitShaders(
+	std::make_index_sequence<static_cast<size_t>( LightingMode::count ) * OPTION_PERMUTATIONS>() ) };
+constexpr auto LIT_BATCH_SHADERS{ MakeLitBatchShaders(
+	std::make_index_sequence<static_cast<size_t>( LightingMode::count ) * OPTION_PERMUTATIONS>() ) };
+
+size_t GetLitPermutation( const Mesh& mesh, LightingMode lightingMode, bool useNormalMap, bool useFastMath )
+{
+	const size_t permutation{ static_cast<size_t>( lightingMode ) * OPTION_PERMUTATIONS +
+							  ( useFastMath ? FAST_MATH_BIT : 0 ) +
+							  ( useNormalMap && mesh.normalMap.IsLoaded() ? NORMAL_MAP_BIT : 0 ) +
+							  ( mesh.specularMap.IsLoaded() ? SPECULAR_MAP_BIT : 0 ) +
+							  ( mesh.glossMap.IsLoaded() ? GLOSS_MAP_BIT : 0 ) };
+	assert( permutation < LIT_SHADERS.size() && "Lighting mode has no shader" );
+	return permutation;
+}
+} // namespace
+
+PixelShader GetPixelShader(
+	const Mesh& mesh, const ShadingLights& lights, LightingMode lightingMode, bool useNormalMap, bool useFastMath )
+{
+	if ( lights.directional.empty() && lights.point.empty() )
+	{
+		return &ShadeUnlit;
+	}
+	return LIT_SHADERS[GetLitPermutation( mesh, lightingMode, useNormalMap, useFastMath )];
+}
+
+BatchShader GetBatchShader(
+	const Mesh& mesh, const ShadingLights& lights, LightingMode lightingMode, bool useNormalMap, bool useFastMath )
+{
+	if ( lights.directional.empty() && lights.point.empty() )
+	{
+		return &ShadeUnlitBatch;
+	}
+	return LIT_BATCH_SHADERS[GetLitPermutation( mesh, lightingMode, useNormalMap, useFastMath )];
 }
 
 namespace lightUtils
 {
+template <LightType type>
 float GetObservedArea( const Light& light, const Vector3& position, const Vector3& normal )
 {
 	Vector3 dirToLight{};
-	switch ( light.type )
+	if constexpr ( type == LightType::point )
 	{
-	case LightType::point:
 		dirToLight = light.vector - position;
-		break;
-
-	case LightType::directional:
+	}
+	else
+	{
 		dirToLight = -light.vector;
-		break;
 	}
 
 	return std::max( Vector3::Dot( normal, dirToLight ), 0.f );
 }
 
+template <LightType type>
 ColorRGB GetRadiance( const Light& light, const Vector3& target )
 {
-	switch ( light.type )
+	if constexpr ( type == LightType::point )
+	{
+		const float sqrDistance{ ( light.vector - target ).SqrMagnitude() };
+		return { light.color * ( light.intensity / sqrDistance * GetRangeFalloff( light, sqrDistance ) ) };
+	}
+	else
 	{
-	case LightType::point:
-		return { light.color * ( light.intensity / ( light.vector - target ).SqrMagnitude() ) };
-		break;
-
-	case LightType::directional:
-		return light.color * light.intensity;
-		break;
-	default:
 		return light.color * light.intensity;
 	}
 }
 
+float GetRangeFalloff( const Light& light, float sqrDistance )
+{
+	if ( light.range <= 0.f )
+	{
+		return 1.f;
+	}
+	const float sqrDistanceRatio{ sqrDistance / ( light.range * light.range ) };
+	const float window{ std::max( 1.f - sqrDistanceRatio * sqrDistanceRatio, 0.f ) };
+	return window * window;
+}
+
+template <bool useFastMath>
 ColorRGB GetPhong( ColorRGB specularReflectance,
 				   float phongExponent,
 				   const Vector3& lightIncomingDir,
@@ -138,9 +875,47 @@ ColorRGB GetPhong( ColorRGB specularReflectance,
 {
 	const Vector3 reflect{ Vector3::Reflect( lightIncomingDir, normal ) };
 	const float dot{ std::max( Vector3::Dot( reflect, toCameraDir ), 0.f ) };
-	const ColorRGB phongReflection{ specularReflectance * std::pow( dot, phongExponent ) };
+	const float power{ useFastMath ? FastPow( dot, phongExponent ) : std::pow( dot, phongExponent ) };
+	const ColorRGB phongReflection{ specularReflectance * power };
 
 	return phongReflection;
 }
+
+float FastPow( float base, float exponent )
+{
+	return FastExp2( exponent * FastLog2( base ) );
+}
+
+float MeasureFastPowError()
+{
+	// Every gloss a map can hold, against bases spread over [0, 1]
+	constexpr int baseSteps{ 4096 };
+	constexpr int glossSteps{ 255 };
+
+	float maxError{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> bases{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> powers{};
+	for ( int glossStep{}; glossStep <= glossSteps; ++glossStep )
+	{
+		const float exponent{ static_cast<float>( glossStep ) / glossSteps * SHININESS };
+		for ( int firstBase{}; firstBase <= baseSteps; firstBase += static_cast<int>( SHADING_BATCH_SIZE ) )
+		{
+			for ( size_t lane{}; lane < SHADING_BATCH_SIZE; ++lane )
+			{
+				bases[lane] = std::min( static_cast<float>( firstBase + lane ) / baseSteps, 1.f );
+			}
+			Pow<true>( Lanes::Load( bases.data() ), Lanes::Splat( exponent ) ).Store( powers.data() );
+
+			// The lanes and the scalar version have to agree with std::pow
+			for ( size_t lane{}; lane < SHADING_BATCH_SIZE; ++lane )
+			{
+				const float exact{ std::pow( bases[lane], exponent ) };
+				maxError = std::max( maxError, std::abs( powers[lane] - exact ) );
+				maxError = std::max( maxError, std::abs( FastPow( bases[lane], exponent ) - exact ) );
+			}
+		}
+	}
+	return maxError;
+}
 } // namespace lightUtils
 } // namespace dae
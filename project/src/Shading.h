@@ -1,5 +1,7 @@
 #ifndef SHADING_H
 #define SHADING_H
+#include <array>
+#include <span>
 #include "Camera.h"
 #include "ColorRGB.h"
 #include "DataTypes.h"
@@ -23,24 +25,93 @@ struct Light final
 	float intensity{};
 
 	LightType type{};
+	float range{}; // A point light fades out towards this distance and reaches nothing past it, zero reaches everything
 };
 
-ColorRGB GetPixelColor( const Mesh& mesh,
-						const VertexOut& pixelVertex,
-						const Camera& camera,
-						const std::vector<Light>& lights,
-						const LightingMode& lightingMode,
-						bool useNormalMap = true );
+// The lights of the scene split by type, so shaders loop over every type without checking it per light
+struct ShadingLights final
+{
+	std::span<const Light> directional{};
+	std::span<const Light> point{};
+	std::span<const uint32_t> pointIndices{}; // Which of the point lights reach the pixels being shaded
+};
+
+// The pixel, the camera position and the lights all have to live in the same space
+using PixelShader = ColorRGB ( * )( const Mesh& mesh,
+									const VertexOut& pixelVertex,
+									const Vector3& cameraPosition,
+									const ShadingLights& lights );
+
+// Picks the specialization of the shader for the lighting mode and the maps the mesh has
+// Meant to be called once per mesh, the shader it returns does not branch on any of these
+// Fast math swaps std::pow for FastPow
+PixelShader GetPixelShader( const Mesh& mesh,
+							const ShadingLights& lights,
+							LightingMode lightingMode,
+							bool useNormalMap = true,
+							bool useFastMath = false );
+
+// Pixels also get shaded eight at a time, every value has its own array so the lanes all do the same math
+constexpr size_t SHADING_BATCH_SIZE{ 8 };
+
+// View space surfaces under a batch of pixels
+struct PixelBatch final
+{
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> positionX{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> positionY{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> positionZ{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> normalX{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> normalY{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> normalZ{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> tangentX{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> tangentY{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> tangentZ{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> u{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> v{};
+};
+
+struct ColorBatch final
+{
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> r{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> g{};
+	alignas( 32 ) std::array<float, SHADING_BATCH_SIZE> b{};
+};
+
+// Shades a batch of pixels that all show the same mesh, the camera sits at the origin
+using BatchShader = void ( * )( const Mesh& mesh,
+								const PixelBatch& pixels,
+								const ShadingLights& lights,
+								ColorBatch& colorsOut );
+
+// Same specializations as the pixel shaders, only the textures get sampled one lane at a time
+BatchShader GetBatchShader( const Mesh& mesh,
+							const ShadingLights& lights,
+							LightingMode lightingMode,
+							bool useNormalMap = true,
+							bool useFastMath = false );
 
 namespace lightUtils
 {
+template <LightType type>
 float GetObservedArea( const Light& light, const Vector3& position, const Vector3& normal );
+template <LightType type>
 ColorRGB GetRadiance( const Light& light, const Vector3& position );
+// Windows the radiance of a point light so it reaches zero at its range, one for lights without a range
+float GetRangeFalloff( const Light& light, float sqrDistance );
+template <bool useFastMath = false>
 ColorRGB GetPhong( ColorRGB specularReflectance,
 				   float phongExponent,
 				   const Vector3& lightIncomingDir,
 				   const Vector3& toCameraDir,
 				   const Vector3& normal );
+
+// Power as exp2( exponent * log2( base ) ) with a polynomial fit for each, the batch shaders do the same math per lane
+// For bases in [0, 1] and exponents up to what a gloss map reaches, it stays within FAST_POW_MAX_ERROR of std::pow
+float FastPow( float base, float exponent );
+constexpr float FAST_POW_MAX_ERROR{ 5e-4f }; // An eighth of a step of an 8 bit color channel
+// Largest difference to std::pow over every gloss and a spread of bases, for both the scalar and the batch version
+// Too slow to run on every start, the executable runs it when given --check-fast-math
+float MeasureFastPowError();
 } // namespace lightUtils
 } // namespace dae
 
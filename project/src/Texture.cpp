@@ -54,6 +54,11 @@ Texture& Texture::operator=( Texture&& rhs )
 	return *this;
 }
 
+bool Texture::IsLoaded() const
+{
+	return m_pSurface != nullptr;
+}
+
 ColorRGB Texture::Sample( const Vector2& uv ) const
 {
 #define FAST_RGB
@@ -61,8 +66,12 @@ ColorRGB Texture::Sample( const Vector2& uv ) const
 	// Convert UV coordinates to texture coordinates
 	const int pixelWidth{ m_pSurface->w };
 	const int pixelHeight{ m_pSurface->h };
-	const int uvpx{ static_cast<int>( std::round( uv.x * pixelWidth ) ) };
-	const int uvpy{ static_cast<int>( std::round( uv.y * pixelHeight ) ) };
+	const auto wrap{ []( int texel, int size ) {
+		const int wrapped{ texel % size };
+		return wrapped < 0 ? wrapped + size : wrapped;
+	} };
+	const int uvpx{ wrap( static_cast<int>( std::round( uv.x * pixelWidth ) ), pixelWidth ) };
+	const int uvpy{ wrap( static_cast<int>( std::round( uv.y * pixelHeight ) ), pixelHeight ) };
 
 // Get RGB
 #ifndef FAST_RGB
@@ -20,7 +20,10 @@ public:
 	Texture& operator=( const Texture& );
 	Texture& operator=( Texture&& rhs );
 
+	// Coordinates outside of [0, 1) repeat the texture
 	ColorRGB Sample( const Vector2& uv ) const;
+	// Meshes leave the maps they do not have default constructed
+	bool IsLoaded() const;
 
 private:
 	SDL_Surface* m_pSurface{};
@@ -2,7 +2,10 @@
 #define UTILS_H
 
 #include <cassert>
+#include <cmath>
 #include <fstream>
+#include <limits>
+#include <unordered_map>
 #include "DataTypes.h"
 
 // #define DISABLE_OBJ
@@ -22,7 +25,44 @@ inline Vector3 ScreenSpaceToNDC( int screenSpaceX, int screenSpaceY, int width,
 } // namespace Units
 namespace Utils
 {
+// Exporters often give every face corner its own normal index, so corners get compared by value
+struct OBJVertexKey
+{
+	Vector3 position{};
+	Vector2 uv{};
+	Vector3 normal{};
+
+	bool operator==( const OBJVertexKey& other ) const noexcept
+	{
+		// Exact comparisons, an epsilon would not agree with the hash
+		return position.x == other.position.x && position.y == other.position.y && position.z == other.position.z &&
+			   uv.x == other.uv.x && uv.y == other.uv.y && normal.x == other.normal.x && normal.y == other.normal.y &&
+			   normal.z == other.normal.z;
+	}
+};
+
+struct OBJVertexKeyHash
+{
+	size_t operator()( const OBJVertexKey& key ) const noexcept
+	{
+		size_t hash{};
+		for ( const float value : { key.position.x,
+									key.position.y,
+									key.position.z,
+									key.uv.x,
+									key.uv.y,
+									key.normal.x,
+									key.normal.y,
+									key.normal.z } )
+		{
+			hash ^= std::hash<float>{}( value ) + 0x9e3779b9 + ( hash << 6 ) + ( hash >> 2 );
+		}
+		return hash;
+	}
+};
+
 // Just parses vertices and indices
+// Face corners with the same position, uv and normal become a single vertex, so shared vertices only get projected once
 #pragma warning( push )
 #pragma warning( disable : 4505 ) // Warning unreferenced local function
 static bool ParseOBJ( const std::string& filename,
@@ -37,6 +77,7 @@ static bool ParseOBJ( const std::string& filename,
 	std::vector<Vector3> positions{};
 	std::vector<Vector3> normals{};
 	std::vector<Vector2> UVs{};
+	std::unordered_map<OBJVertexKey, uint32_t, OBJVertexKeyHash> vertexIndices{};
 
 	vertices.clear();
 	indices.clear();
@@ -83,12 +124,12 @@ static bool ParseOBJ( const std::string& filename,
 			// add the material index as attibute to the attribute array
 			//
 			//  Faces or triangles
-			Vertex vertex{};
-			size_t iPosition, iTexCoord, iNormal;
-
 			uint32_t tempIndices[3];
 			for ( size_t iFace = 0; iFace < 3; iFace++ )
 			{
+				Vertex vertex{};
+				size_t iPosition, iTexCoord, iNormal;
+
 				// OBJ format uses 1-based arrays
 				file >> iPosition;
 				vertex.position = positions[iPosition - 1];
@@ -114,9 +155,14 @@ static bool ParseOBJ( const std::string& filename,
 					}
 				}
 
-				vertices.push_back( vertex );
-				tempIndices[iFace] = uint32_t( vertices.size() ) - 1;
-				// indices.push_back(uint32_t(vertices.size()) - 1);
+				// Reuse the vertex when this combination was seen before
+				const OBJVertexKey key{ vertex.position, vertex.uv, vertex.normal };
+				const auto [it, isNew] = vertexIndices.try_emplace( key, uint32_t( vertices.size() ) );
+				if ( isNew )
+				{
+					vertices.push_back( vertex );
+				}
+				tempIndices[iFace] = it->second;
 			}
 
 			indices.push_back( tempIndices[0] );
@@ -153,7 +199,12 @@ static bool ParseOBJ( const std::string& filename,
 		const Vector3 edge1 = p2 - p0;
 		const Vector2 diffX = Vector2( uv1.x - uv0.x, uv2.x - uv0.x );
 		const Vector2 diffY = Vector2( uv1.y - uv0.y, uv2.y - uv0.y );
-		float r = 1.f / Vector2::Cross( diffX, diffY );
+		const float uvArea = Vector2::Cross( diffX, diffY );
+
+		// Welded vertices are shared between faces, one without a uv mapping would spoil the tangent of all of them
+		if ( uvArea == 0.f )
+			continue;
+		float r = 1.f / uvArea;
 
 		Vector3 tangent = ( edge0 * diffY.y - edge1 * diffY.x ) * r;
 		vertices[index0].tangent += tangent;
@@ -164,7 +215,17 @@ static bool ParseOBJ( const std::string& filename,
 	// Fix the tangents per vertex now because we accumulated
 	for ( auto& v : vertices )
 	{
-		v.tangent = Vector3::Reject( v.tangent, v.normal ).Normalized();
+		const Vector3 tangent{ Vector3::Reject( v.tangent, v.normal ) };
+		if ( tangent.SqrMagnitude() > std::numeric_limits<float>::min() )
+		{
+			v.tangent = tangent.Normalized();
+		}
+		else
+		{
+			// None of its faces had a uv mapping, any direction along the surface keeps the normal map from turning NaN
+			const Vector3 axis{ std::abs( v.normal.x ) < 0.9f ? Vector3{ 1.f, 0.f, 0.f } : Vector3{ 0.f, 1.f, 0.f } };
+			v.tangent = Vector3::Cross( axis, v.normal ).Normalized();
+		}
 
 		if ( flipAxisAndWinding )
 		{
@@ -4,10 +4,13 @@
 #undef main
 
 // Standard includes
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
 
 // Project includes
+#include "AllocationCounter.h"
 #include "Renderer.h"
 #include "Timer.h"
 #include "Scene.h"
@@ -18,23 +21,66 @@
 
 using namespace dae;
 
+// How long an idle frame sleeps at most while waiting for input
+constexpr uint32_t IDLE_TIMEOUT_MS{ 100 };
+
 void ShutDown( SDL_Window* pWindow )
 {
 	SDL_DestroyWindow( pWindow );
 	SDL_Quit();
 }
 
-int main( int argc, char* args[] )
+// Flies the camera from where the scene starts towards its origin twice, through near plane clipping and crowded tiles
+// The first flight grows every buffer the renderer keeps, so the second one may not allocate at all
+bool CheckAllocations( Renderer& renderer, Scene& scene, Timer& timer )
 {
-	// Unreferenced parameters
-	(void)argc;
-	(void)args;
+#ifdef NDEBUG
+	(void)renderer;
+	(void)scene;
+	(void)timer;
+	std::cout << "Allocations are only counted in debug builds" << std::endl;
+	return false;
+#else
+	constexpr int flightFrames{ 32 };
+	const Vector3 start{ scene.GetCamera().GetPosition() };
+	size_t allocationCount{};
+	for ( int flight{}; flight < 2; ++flight )
+	{
+		const size_t flightStartCount{ GetAllocationCount() };
+		for ( int frame{}; frame < flightFrames; ++frame )
+		{
+			scene.GetCamera().SetPos( start * ( 1.f - static_cast<float>( frame ) / flightFrames ) );
+			scene.Update( &timer );
+
+			// Every other frame at reduced resolution, so both layouts of the tiles get used
+			renderer.SetReducedResolution( frame % 2 == 1 );
+			renderer.Render( &scene );
+		}
+		allocationCount = GetAllocationCount() - flightStartCount;
+	}
+	std::cout << "Allocations after warm-up: " << allocationCount << std::endl;
+	return allocationCount == 0;
+#endif
+}
 
+int main( int argc, char* args[] )
+{
 // Leak detection
 #if defined( _DEBUG )
 	LeakDetector detector{};
 #endif
 
+	// --check-fast-math compares the fast shading math against std::pow and exits, failing when it drifted too far
+	for ( int argIndex{ 1 }; argIndex < argc; ++argIndex )
+	{
+		if ( std::strcmp( args[argIndex], "--check-fast-math" ) == 0 )
+		{
+			const float error{ lightUtils::MeasureFastPowError() };
+			std::cout << "Fast pow error: " << error << " (allowed " << lightUtils::FAST_POW_MAX_ERROR << ")" << std::endl;
+			return error <= lightUtils::FAST_POW_MAX_ERROR ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
 	// Create window + surfaces
 	SDL_Init( SDL_INIT_VIDEO );
 
@@ -56,6 +102,15 @@ int main( int argc, char* args[] )
 	Timer timer{};
 	Renderer renderer{ pWindow };
 
+	// --resolve-threads <count> limits how many threads resolve a frame, zero uses every hardware thread
+	for ( int argIndex{ 1 }; argIndex + 1 < argc; ++argIndex )
+	{
+		if ( std::strcmp( args[argIndex], "--resolve-threads" ) == 0 )
+		{
+			renderer.SetResolveThreadCount( static_cast<uint32_t>( std::strtoul( args[argIndex + 1], nullptr, 10 ) ) );
+		}
+	}
+
 	/*
 	Why was this on the heap????????
 	const auto pTimer = new Timer();
@@ -66,6 +121,17 @@ int main( int argc, char* args[] )
 	auto upScene{ std::make_unique<SceneW5>() };
 	upScene->Initialize();
 
+	// --check-allocations renders a fixed camera flight and exits, failing when the renderer allocated after warm-up
+	for ( int argIndex{ 1 }; argIndex < argc; ++argIndex )
+	{
+		if ( std::strcmp( args[argIndex], "--check-allocations" ) == 0 )
+		{
+			const bool isAllocationFree{ CheckAllocations( renderer, *upScene, timer ) };
+			ShutDown( pWindow );
+			return isAllocationFree ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
 	// Start loop
 	timer.Start();
 
@@ -75,6 +141,14 @@ int main( int argc, char* args[] )
 	float printTimer = 0.f;
 	bool isLooping = true;
 	bool takeScreenshot = false;
+
+	// On demand, a frame only gets rendered when something changed, toggled with F10
+	// Frames while the camera moves are rendered at reduced resolution and refined once it stops
+	bool isRenderingOnDemand{ true };
+	bool isRefinementPending{ true };
+	uint32_t renderedCameraVersion{};
+	uint32_t renderedTransformVersion{};
+	uint32_t renderedSettingsVersion{};
 	while ( isLooping )
 	{
 		//--------- Get input events ---------
@@ -89,6 +163,17 @@ int main( int argc, char* args[] )
 			case SDL_KEYUP:
 				if ( e.key.keysym.scancode == SDL_SCANCODE_X )
 					takeScreenshot = true;
+				if ( e.key.keysym.scancode == SDL_SCANCODE_F10 )
+				{
+					isRenderingOnDemand = !isRenderingOnDemand;
+					isRefinementPending = true;
+					std::cout << ( isRenderingOnDemand ? "Rendering on demand" : "Rendering continuously" ) << std::endl;
+				}
+				break;
+			case SDL_WINDOWEVENT:
+				// The window surface may have lost its contents
+				if ( e.window.event == SDL_WINDOWEVENT_EXPOSED )
+					isRefinementPending = true;
 				break;
 			}
 		}
@@ -98,7 +183,31 @@ int main( int argc, char* args[] )
 		renderer.Update( &timer );
 
 		//--------- Render ---------
-		renderer.Render( upScene.get() );
+		const uint32_t cameraVersion{ upScene->GetCamera().GetVersion() };
+		const uint32_t transformVersion{ upScene->GetTransformVersion() };
+		const uint32_t settingsVersion{ renderer.GetSettingsVersion() };
+		const bool isCameraMoving{ cameraVersion != renderedCameraVersion };
+		const bool hasChanged{ isCameraMoving || transformVersion != renderedTransformVersion ||
+							   settingsVersion != renderedSettingsVersion };
+		if ( !isRenderingOnDemand || hasChanged || isRefinementPending )
+		{
+			const bool isReduced{ isRenderingOnDemand && isCameraMoving };
+			renderer.SetReducedResolution( isReduced );
+			renderer.Render( upScene.get() );
+
+			isRefinementPending = isReduced;
+			renderedCameraVersion = cameraVersion;
+			renderedTransformVersion = transformVersion;
+			renderedSettingsVersion = settingsVersion;
+		}
+		else
+		{
+			// The last frame is still correct, sleep until input arrives instead of drawing it again
+			// The timer is paused meanwhile, so the first frame after waking does not move by the time slept
+			timer.Stop();
+			SDL_WaitEventTimeout( nullptr, IDLE_TIMEOUT_MS );
+			timer.Start();
+		}
 
 		//--------- Timer ---------
 		timer.Update();